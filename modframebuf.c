@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include "py/runtime.h"
 #include "py/binary.h"
@@ -58,6 +59,28 @@ typedef struct _font_inf_t{
   uint32_t Base_Addr32;		//xuanzhuan 0,32dot font no exist
 }font_inf_t;
 
+// Sizes are 16 bits, which keeps the object small on microcontrollers. A
+// port that renders very large canvases, such as unix drawing posters
+// offline, can define MICROPY_PY_FRAMEBUF_LARGE to 1: sizes and pixel
+// indices are then mp_int_t, so a buffer may exceed 65535 pixels a side and
+// 2 GB. Both stay signed, so comparisons with coordinates are unchanged.
+#ifndef MICROPY_PY_FRAMEBUF_LARGE
+#define MICROPY_PY_FRAMEBUF_LARGE (0)
+#endif
+
+#if MICROPY_PY_FRAMEBUF_LARGE
+typedef mp_int_t fb_size_t;
+typedef mp_int_t fb_index_t;
+// Coordinates are int, so leave room for x + w.
+#define FRAMEBUF_SIZE_MAX (0x3fffffff)
+#define FRAMEBUF_INDEX_MAX (MP_SSIZE_MAX)
+#else
+typedef uint16_t fb_size_t;
+typedef int fb_index_t;
+#define FRAMEBUF_SIZE_MAX (0xffff)
+#define FRAMEBUF_INDEX_MAX (INT_MAX)
+#endif
+
 typedef struct _mp_obj_framebuf_t {
     mp_obj_base_t base;
     mp_obj_t buf_obj; // need to store this to prevent GC from reclaiming buf
@@ -65,8 +88,13 @@ typedef struct _mp_obj_framebuf_t {
     font_set_t font_set;
     font_inf_t font_inf;
     void *buf;
-    uint16_t width, height, stride;
+    fb_size_t width, height, stride;
+    fb_size_t band_y, band_h;   // screen rows held by a banded buffer, band_h 0 if not banded
     uint8_t format;
+    bool read_only;             // wraps bytes or other read-only memory, usable as a source only
+    uint32_t *palette;          // 0xRRGGBB colours of a PAL buffer, NULL for other formats
+    uint8_t tile;               // log2 of the tile side of a tiled buffer, 0 if stored in lines
+    fb_size_t line_stride;      // stride to restore when a tiled buffer goes back to lines
 } mp_obj_framebuf_t;
 
 #if !MICROPY_ENABLE_DYNRUNTIME
@@ -75,10 +103,12 @@ STATIC const mp_obj_type_t mp_type_framebuf;
 
 typedef void (*setpixel_t)(const mp_obj_framebuf_t *, int, int, uint32_t);
 typedef uint32_t (*getpixel_t)(const mp_obj_framebuf_t *, int, int);
+typedef void (*fill_rect_t)(const mp_obj_framebuf_t *, int, int, int, int, uint32_t, int);
 
 typedef struct _mp_framebuf_p_t {
     setpixel_t setpixel;
     getpixel_t getpixel;
+    fill_rect_t fill_rect;
 } mp_framebuf_p_t;
 
 // constants for formats
@@ -108,10 +138,44 @@ typedef struct _mp_framebuf_p_t {
 
 #define FRAMEBUF_ST7302     (0XA0)
 
+#define FRAMEBUF_RGB332     (0XC0)
+#define FRAMEBUF_RGB444     (0XC1)
+#define FRAMEBUF_RGB666     (0XC2)
+
+#define FRAMEBUF_PAL2       (0XE0)
+#define FRAMEBUF_PAL4       (0XE1)
+#define FRAMEBUF_PAL8       (0XE2)
+
 #define FRAMEBUF_MX         (0X04)
 #define FRAMEBUF_MY         (0X08)
 #define FRAMEBUF_MV         (0X10)
 
+// raster ops for fill_rect, rect and blit; NOT inverts the target
+#define FRAMEBUF_ROP_COPY   (0)
+#define FRAMEBUF_ROP_XOR    (1)
+#define FRAMEBUF_ROP_OR     (2)
+#define FRAMEBUF_ROP_AND    (3)
+#define FRAMEBUF_ROP_NOT    (4)
+
+// dithering when colour depth is reduced to grey or mono
+#define FRAMEBUF_DITHER_NONE    (0)
+#define FRAMEBUF_DITHER_BAYER4  (1)
+#define FRAMEBUF_DITHER_BAYER8  (2)
+#define FRAMEBUF_DITHER_FS      (3)
+
+// display list opcodes for execute()
+#define FRAMEBUF_DL_END         (0)
+#define FRAMEBUF_DL_FILL        (1)
+#define FRAMEBUF_DL_PIXEL       (2)
+#define FRAMEBUF_DL_HLINE       (3)
+#define FRAMEBUF_DL_VLINE       (4)
+#define FRAMEBUF_DL_LINE        (5)
+#define FRAMEBUF_DL_RECT        (6)
+#define FRAMEBUF_DL_FILL_RECT   (7)
+#define FRAMEBUF_DL_ELLIPSE     (8)
+#define FRAMEBUF_DL_BLIT        (9)
+#define FRAMEBUF_DL_TEXT        (10)
+
 
 // constants for formats
 #define Font_S12    (0x11)
@@ -254,7 +318,7 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_font_set_obj, 2, 6, framebuf
 
 STATIC void st7302_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col) {
     //bit0设置位顺序，0低位在前，bit1设置排列方式，0为垂直方式方式
-    int index;
+    fb_index_t index;
     int offset;
     if ((fb->format & FRAMEBUF_MV) == 0x00){
         index  = ((y >> 1) * fb->stride + x) >> 2;
@@ -267,7 +331,7 @@ STATIC void st7302_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t
 }
 
 STATIC uint32_t st7302_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
-    int index;
+    fb_index_t index;
     int offset;
     if ((fb->format & FRAMEBUF_MV) == 0x00){
         index  = ((y >> 1) * fb->stride + x) >> 2;
@@ -279,11 +343,172 @@ STATIC uint32_t st7302_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
     return (((uint8_t *)fb->buf)[index] >> (offset)) & 0x01;
 }
 
+// Raster ops work on raw bits, so the same helpers serve whole bytes,
+// whole words and single pixel values.
+static inline uint32_t rop_apply(uint32_t dst, uint32_t src, int rop) {
+    switch (rop) {
+        case FRAMEBUF_ROP_XOR:
+            return dst ^ src;
+        case FRAMEBUF_ROP_OR:
+            return dst | src;
+        case FRAMEBUF_ROP_AND:
+            return dst & src;
+        case FRAMEBUF_ROP_NOT:
+            return ~dst;
+        default:
+            return src;
+    }
+}
+
+// Applies rop to the bits of *b selected by mask.
+static inline void rop_byte(uint8_t *b, uint8_t mask, uint8_t pattern, int rop) {
+    *b = (*b & ~mask) | (rop_apply(*b, pattern, rop) & mask);
+}
+
+// Applies rop with a repeated byte pattern to n whole bytes, a word at a
+// time once the pointer is aligned.
+STATIC void rop_bytes(uint8_t *b, size_t n, uint8_t pattern, int rop) {
+    if (rop == FRAMEBUF_ROP_COPY) {
+        memset(b, pattern, n);
+        return;
+    }
+    for (; n && ((uintptr_t)b & 3); --n, ++b) {
+        *b = rop_apply(*b, pattern, rop);
+    }
+    uint32_t pattern32 = pattern * 0x01010101u;
+    for (; n >= 4; n -= 4, b += 4) {
+        *(uint32_t *)b = rop_apply(*(uint32_t *)b, pattern32, rop);
+    }
+    for (; n; --n, ++b) {
+        *b = rop_apply(*b, pattern, rop);
+    }
+}
+
+// A byte holds 4 columns of 2 rows, column-major from the high bit.
+STATIC void st7302_fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col, int rop) {
+    if ((fb->format & FRAMEBUF_MV) != 0x00) {
+        int t = x;
+        x = y;
+        y = t;
+        t = w;
+        w = h;
+        h = t;
+    }
+    uint8_t pattern = col ? 0xff : 0x00;
+    uint8_t *buf = (uint8_t *)fb->buf;
+    int xend = x + w;
+    int yend = y + h;
+    while (y < yend) {
+        int band = y >> 1;
+        // Bits of the rows of this band that are inside the rectangle.
+        uint8_t rows = 0;
+        for (int r = y; r < MIN(yend, (band + 1) * 2); r++) {
+            rows |= 0xaa >> (r & 1);
+        }
+        uint8_t *row = &buf[(band * fb->stride) >> 2];
+        int xx = x;
+        while (xx < xend) {
+            int group_end = MIN(xend, (xx & ~3) + 4);
+            uint8_t mask;
+            if ((xx & 3) == 0 && group_end == xx + 4 && rows == 0xff) {
+                // Whole bytes.
+                int n = (xend - xx) >> 2;
+                rop_bytes(&row[xx >> 2], n, pattern, rop);
+                xx += n << 2;
+                continue;
+            }
+            mask = 0;
+            for (int c = xx; c < group_end; c++) {
+                mask |= 0xc0 >> ((c & 3) * 2);
+            }
+            rop_byte(&row[xx >> 2], mask & rows, pattern, rop);
+            xx = group_end;
+        }
+        y = (band + 1) * 2;
+    }
+}
+
+// Fill for the packed 1, 2 and 4 bit formats
+
+// Mask of the pixels p0..p1-1 of a packed byte.
+STATIC uint8_t packed_mask(int p0, int p1, int bpp, bool msb) {
+    int ppb = 8 / bpp;
+    uint8_t mask = 0;
+    for (int p = p0; p < p1; p++) {
+        mask |= ((1 << bpp) - 1) << ((msb ? ppb - 1 - p : p) * bpp);
+    }
+    return mask;
+}
+
+// Fills a rectangle given in memory order, i.e. already swapped for MV:
+// vertical packs a column of pixels into each byte, otherwise a row, and
+// msb puts the first pixel in the high bits. Whole bytes are written at once.
+STATIC void packed_fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, int bpp, bool vertical, bool msb, uint32_t col, int rop) {
+    int ppb = 8 / bpp;
+    uint8_t pattern = col & ((1 << bpp) - 1);
+    for (int i = bpp; i < 8; i <<= 1) {
+        pattern |= pattern << i;
+    }
+    uint8_t *buf = (uint8_t *)fb->buf;
+    if (vertical) {
+        int yend = y + h;
+        while (y < yend) {
+            int band = y / ppb;
+            int band_end = MIN(yend, (band + 1) * ppb);
+            uint8_t mask = packed_mask(y - band * ppb, band_end - band * ppb, bpp, msb);
+            uint8_t *b = &buf[band * fb->stride + x];
+            if (mask == 0xff) {
+                rop_bytes(b, w, pattern, rop);
+            } else {
+                for (int ww = w; ww; --ww, ++b) {
+                    rop_byte(b, mask, pattern, rop);
+                }
+            }
+            y = band_end;
+        }
+    } else {
+        for (; h; --h, ++y) {
+            fb_index_t p = y * fb->stride + x;
+            fb_index_t pend = p + w;
+            uint8_t *b = &buf[p / ppb];
+            if (p % ppb) {
+                fb_index_t e = MIN(pend, (p / ppb + 1) * ppb);
+                rop_byte(b, packed_mask(p % ppb, e - p / ppb * ppb, bpp, msb), pattern, rop);
+                ++b;
+                p = e;
+            }
+            int n = (pend - p) / ppb;
+            if (n > 0) {
+                rop_bytes(b, n, pattern, rop);
+                b += n;
+                p += n * ppb;
+            }
+            if (p < pend) {
+                rop_byte(b, packed_mask(0, pend - p, bpp, msb), pattern, rop);
+            }
+        }
+    }
+}
+
+STATIC void packed_fill_format(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, int bpp, uint32_t col, int rop) {
+    bool vertical = (fb->format & 0x02) == 0;
+    if ((fb->format & FRAMEBUF_MV) != 0x00) {
+        int t = x;
+        x = y;
+        y = t;
+        t = w;
+        w = h;
+        h = t;
+        vertical = !vertical;
+    }
+    packed_fill_rect(fb, x, y, w, h, bpp, vertical, fb->format & 0x01, col, rop);
+}
+
 // Functions for mon format
 
 STATIC void mon_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col) {
     //bit0设置位顺序，0低位在前，bit1设置排列方式，0为垂直方式方式
-    int index;
+    fb_index_t index;
     int offset;
     if ((fb->format & FRAMEBUF_MV) == 0x00){
         if ((fb->format & 0x02) == 0x00){
@@ -306,7 +531,7 @@ STATIC void mon_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col
 }
 
 STATIC uint32_t mon_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
-    int index;
+    fb_index_t index;
     int offset;
     if ((fb->format & FRAMEBUF_MV) == 0x00){
         if ((fb->format & 0x02) == 0x00){
@@ -328,11 +553,15 @@ STATIC uint32_t mon_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
     return (((uint8_t *)fb->buf)[index] >> (offset)) & 0x01;
 }
 
+STATIC void mon_fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col, int rop) {
+    packed_fill_format(fb, x, y, w, h, 1, col != 0, rop);
+}
+
 // Functions for GS2 format
 
 STATIC void gs2_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col) {
     //bit0设置位顺序，0低位在前，bit1设置排列方式，0为垂直方式
-    int index;
+    fb_index_t index;
     int offset;
     if ((fb->format & FRAMEBUF_MV) == 0x00){
         if ((fb->format & 0x02) == 0x00){
@@ -355,7 +584,7 @@ STATIC void gs2_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col
 }
 
 STATIC uint32_t gs2_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
-    int index;
+    fb_index_t index;
     int offset;
     if ((fb->format & FRAMEBUF_MV) == 0x00){
         if ((fb->format & 0x02) == 0x00){
@@ -377,11 +606,15 @@ STATIC uint32_t gs2_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
     return (((uint8_t *)fb->buf)[index] >> (offset*2)) & 0x03;
 }
 
+STATIC void gs2_fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col, int rop) {
+    packed_fill_format(fb, x, y, w, h, 2, col, rop);
+}
+
 // Functions for GS4 format
 
 STATIC void gs4_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col) {
     //bit0设置位顺序，0低位在前，bit1设置排列方式，0为垂直方式
-    int index;
+    fb_index_t index;
     int offset;
     if ((fb->format & FRAMEBUF_MV) == 0x00){
         if ((fb->format & 0x02) == 0x00){
@@ -404,7 +637,7 @@ STATIC void gs4_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col
 }
 
 STATIC uint32_t gs4_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
-    int index;
+    fb_index_t index;
     int offset;
     if ((fb->format & FRAMEBUF_MV) == 0x00){
         if ((fb->format & 0x02) == 0x00){
@@ -426,10 +659,14 @@ STATIC uint32_t gs4_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
     return (((uint8_t *)fb->buf)[index] >> (offset*4)) & 0x0f;
 }
 
+STATIC void gs4_fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col, int rop) {
+    packed_fill_format(fb, x, y, w, h, 4, col, rop);
+}
+
 // Functions for GS8 format
 
 STATIC void gs8_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col) {
-    int index;
+    fb_index_t index;
     if ((fb->format & FRAMEBUF_MV) == 0x00){
         if ((fb->format & 0x02) == 0){
             index  = y * fb->stride + x;
@@ -447,7 +684,7 @@ STATIC void gs8_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col
 }
 
 STATIC uint32_t gs8_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
-    int index;
+    fb_index_t index;
     if ((fb->format & FRAMEBUF_MV) == 0x00){
         if ((fb->format & 0x02) == 0){
             index  = y * fb->stride + x;
@@ -464,11 +701,30 @@ STATIC uint32_t gs8_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
     return ((uint8_t *)fb->buf)[index];
 }
 
+STATIC void gs8_fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col, int rop) {
+    uint8_t *b;
+    int step;
+    if ((fb->format & 0x02) == 0) {
+        b = &((uint8_t *)fb->buf)[y * fb->stride + x];
+        step = fb->stride;
+    } else {
+        // Columns are contiguous.
+        b = &((uint8_t *)fb->buf)[x * fb->stride + y];
+        step = fb->stride;
+        int t = w;
+        w = h;
+        h = t;
+    }
+    for (; h; --h, b += step) {
+        rop_bytes(b, w, col, rop);
+    }
+}
+
 // Functions for RGB format
 
 STATIC void rgb_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col) {
     if ((fb->format & FRAMEBUF_MV) == 0x00){
-        switch (fb->format&0x1F){
+        switch (fb->format&0x03){
             case 0:
             ((uint16_t *)fb->buf)[x + y * fb->stride] = col;
             break;
@@ -486,7 +742,7 @@ STATIC void rgb_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col
             break;
         }
     }else{
-        switch (fb->format&0x1F){
+        switch (fb->format&0x03){
             case 0:
             ((uint16_t *)fb->buf)[y + x * fb->stride] = col;
             break;
@@ -509,7 +765,7 @@ STATIC void rgb_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col
 
 STATIC uint32_t rgb_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
     if ((fb->format & FRAMEBUF_MV) == 0x00){
-        switch (fb->format&0x1F){
+        switch (fb->format&0x03){
             case 0:
             return ((uint16_t *)fb->buf)[x + y * fb->stride];
             break;
@@ -518,14 +774,14 @@ STATIC uint32_t rgb_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
             break;
             case 2:
             return ((((uint8_t *)fb->buf)[(x + y * fb->stride)*3]<<16)|(((uint8_t *)fb->buf)[(x + y * fb->stride)*3+1]<<8)
-            ||((uint8_t *)fb->buf)[(x + y * fb->stride)*3+2]);
+            |((uint8_t *)fb->buf)[(x + y * fb->stride)*3+2]);
             break;
             case 3:
             return ((uint32_t *)fb->buf)[x + y * fb->stride];
             break;
         }
     }else{
-        switch (fb->format&0x1F){
+        switch (fb->format&0x03){
             case 0:
             return ((uint16_t *)fb->buf)[y + x * fb->stride];
             break;
@@ -534,7 +790,7 @@ STATIC uint32_t rgb_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
             break;
             case 2:
             return ((((uint8_t *)fb->buf)[(y + x * fb->stride)*3]<<16)|(((uint8_t *)fb->buf)[(y + x * fb->stride)*3+1]<<8)
-            ||((uint8_t *)fb->buf)[(y + x * fb->stride)*3+2]);
+            |((uint8_t *)fb->buf)[(y + x * fb->stride)*3+2]);
             break;
             case 3:
             return ((uint32_t *)fb->buf)[y + x * fb->stride];
@@ -544,25 +800,444 @@ STATIC uint32_t rgb_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
     return 0;
 }
 
+STATIC void rgb_fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col, int rop) {
+    if ((fb->format & FRAMEBUF_MV) != 0x00) {
+        // Columns are contiguous.
+        int t = x;
+        x = y;
+        y = t;
+        t = w;
+        w = h;
+        h = t;
+    }
+    size_t index = x + y * fb->stride;
+    if (rop != FRAMEBUF_ROP_COPY) {
+        // Raster ops are bitwise, so they can work on the bytes of a pixel
+        // as stored.
+        static const uint8_t pixel_bytes[4] = { 2, 2, 3, 4 };
+        int n = pixel_bytes[fb->format & 0x03];
+        uint8_t pixel[4];
+        switch (fb->format&0x03){
+            case 0: {
+                uint16_t v = col;
+                memcpy(pixel, &v, 2);
+                break;
+            }
+            case 1:
+                pixel[0] = (col >> 8) & 0xff;
+                pixel[1] = col & 0xff;
+                break;
+            case 2:
+                pixel[0] = (col >> 16) & 0xff;
+                pixel[1] = (col >> 8) & 0xff;
+                pixel[2] = col & 0xff;
+                break;
+            case 3:
+                memcpy(pixel, &col, 4);
+                break;
+        }
+        uint8_t *row = &((uint8_t *)fb->buf)[index * n];
+        for (; h; --h, row += fb->stride * n) {
+            uint8_t *b = row;
+            for (int ww = w; ww; --ww) {
+                for (int k = 0; k < n; k++, b++) {
+                    *b = rop_apply(*b, pixel[k], rop);
+                }
+            }
+        }
+        return;
+    }
+    for (; h; --h, index += fb->stride) {
+        switch (fb->format&0x03){
+            case 0: {
+                uint16_t *b = &((uint16_t *)fb->buf)[index];
+                for (int ww = w; ww; --ww) {
+                    *b++ = col;
+                }
+                break;
+            }
+            case 1: {
+                uint8_t *b = &((uint8_t *)fb->buf)[index * 2];
+                for (int ww = w; ww; --ww) {
+                    *b++ = (col >> 8) & 0xff;
+                    *b++ = col & 0xff;
+                }
+                break;
+            }
+            case 2: {
+                uint8_t *b = &((uint8_t *)fb->buf)[index * 3];
+                for (int ww = w; ww; --ww) {
+                    *b++ = (col >> 16) & 0xff;
+                    *b++ = (col >> 8) & 0xff;
+                    *b++ = col & 0xff;
+                }
+                break;
+            }
+            case 3: {
+                uint32_t *b = &((uint32_t *)fb->buf)[index];
+                for (int ww = w; ww; --ww) {
+                    *b++ = col;
+                }
+                break;
+            }
+        }
+    }
+}
+
+// Index of pixel (x, y) along the stored lines of a format without
+// sub-layouts.
+static inline size_t pixel_index(const mp_obj_framebuf_t *fb, int x, int y) {
+    return (fb->format & FRAMEBUF_MV) == 0 ? x + y * fb->stride : y + x * fb->stride;
+}
+
+// Functions for the compact RGB formats. RGB332 is a byte per pixel, RGB666
+// three bytes R, G, B with the colour in the top six bits of each, as the
+// 18-bit mode of ILI9488 style panels takes it. RGB444 packs two pixels in
+// three bytes, R1G1 B1R2 G2B2, as 12-bit mode panels take them.
+
+STATIC void rgbc_set(const mp_obj_framebuf_t *fb, size_t i, uint32_t col) {
+    uint8_t *b = (uint8_t *)fb->buf;
+    switch (fb->format & 0x03) {
+        case 0:
+            b[i] = col;
+            break;
+        case 1:
+            b = &b[i / 2 * 3];
+            if (i & 1) {
+                b[1] = (b[1] & 0xf0) | ((col >> 8) & 0x0f);
+                b[2] = col;
+            } else {
+                b[0] = col >> 4;
+                b[1] = (b[1] & 0x0f) | ((col << 4) & 0xf0);
+            }
+            break;
+        default:
+            b = &b[i * 3];
+            b[0] = (col >> 16) & 0xfc;
+            b[1] = (col >> 8) & 0xfc;
+            b[2] = col & 0xfc;
+            break;
+    }
+}
+
+STATIC uint32_t rgbc_get(const mp_obj_framebuf_t *fb, size_t i) {
+    const uint8_t *b = (const uint8_t *)fb->buf;
+    switch (fb->format & 0x03) {
+        case 0:
+            return b[i];
+        case 1:
+            b = &b[i / 2 * 3];
+            return i & 1 ? ((b[1] & 0x0f) << 8) | b[2] : (b[0] << 4) | (b[1] >> 4);
+        default:
+            b = &b[i * 3];
+            return ((b[0] << 16) | (b[1] << 8) | b[2]) & 0xfcfcfc;
+    }
+}
+
+STATIC void rgbc_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col) {
+    rgbc_set(fb, pixel_index(fb, x, y), col);
+}
+
+STATIC uint32_t rgbc_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
+    return rgbc_get(fb, pixel_index(fb, x, y));
+}
+
+STATIC void rgbc_fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col, int rop) {
+    size_t index = pixel_index(fb, x, y);
+    if ((fb->format & FRAMEBUF_MV) != 0x00) {
+        // Columns are contiguous.
+        int t = w;
+        w = h;
+        h = t;
+    }
+    for (; h; --h, index += fb->stride) {
+        size_t i = index, end = index + w;
+        if (rop != FRAMEBUF_ROP_COPY) {
+            for (; i < end; i++) {
+                rgbc_set(fb, i, rop_apply(rgbc_get(fb, i), col, rop));
+            }
+            continue;
+        }
+        uint8_t *b = (uint8_t *)fb->buf;
+        switch (fb->format & 0x03) {
+            case 0:
+                memset(&b[i], col, w);
+                break;
+            case 1:
+                // Whole pairs are three bytes of one pattern; odd ends are
+                // set by pixel.
+                if (i & 1) {
+                    rgbc_set(fb, i++, col);
+                }
+                for (b = &b[i / 2 * 3]; i + 2 <= end; i += 2) {
+                    *b++ = col >> 4;
+                    *b++ = ((col << 4) & 0xf0) | ((col >> 8) & 0x0f);
+                    *b++ = col;
+                }
+                if (i < end) {
+                    rgbc_set(fb, i, col);
+                }
+                break;
+            default:
+                for (b = &b[i * 3]; i < end; i++) {
+                    *b++ = (col >> 16) & 0xfc;
+                    *b++ = (col >> 8) & 0xfc;
+                    *b++ = col & 0xfc;
+                }
+                break;
+        }
+    }
+}
+// Functions for PAL format. Pixels are indices into the buffer's palette,
+// packed along the lines from the high bits like BMP files: PAL2 four to
+// a byte, PAL4 two and PAL8 one.
+
+static inline int pal_bits(uint8_t format) {
+    return 2 << (format & 0x03);
+}
+
+STATIC void pal_set(const mp_obj_framebuf_t *fb, size_t i, uint32_t col) {
+    int bits = pal_bits(fb->format);
+    uint8_t mask = (1 << bits) - 1;
+    int shift = 8 - bits - (i * bits & 7);
+    uint8_t *b = &((uint8_t *)fb->buf)[i * bits >> 3];
+    *b = (*b & ~(mask << shift)) | ((col & mask) << shift);
+}
+
+STATIC uint32_t pal_get(const mp_obj_framebuf_t *fb, size_t i) {
+    int bits = pal_bits(fb->format);
+    int shift = 8 - bits - (i * bits & 7);
+    return (((const uint8_t *)fb->buf)[i * bits >> 3] >> shift) & ((1 << bits) - 1);
+}
+
+STATIC void pal_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col) {
+    pal_set(fb, pixel_index(fb, x, y), col);
+}
+
+STATIC uint32_t pal_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
+    return pal_get(fb, pixel_index(fb, x, y));
+}
+
+STATIC void pal_fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col, int rop) {
+    size_t index = pixel_index(fb, x, y);
+    if ((fb->format & FRAMEBUF_MV) != 0x00) {
+        // Columns are contiguous.
+        int t = w;
+        w = h;
+        h = t;
+    }
+    int bits = pal_bits(fb->format);
+    int ppb = 8 / bits;
+    uint32_t mask = (1 << bits) - 1;
+    uint8_t pattern = (col & mask) * (0xff / mask);
+    for (; h; --h, index += fb->stride) {
+        // Whole bytes between the partial ones at the ends.
+        size_t i = index, end = index + w;
+        for (; i < end && i % ppb; i++) {
+            pal_set(fb, i, rop_apply(pal_get(fb, i), col, rop));
+        }
+        if (end - i >= (size_t)ppb) {
+            size_t n = (end - i) / ppb;
+            rop_bytes(&((uint8_t *)fb->buf)[i / ppb], n, pattern, rop);
+            i += n * ppb;
+        }
+        for (; i < end; i++) {
+            pal_set(fb, i, rop_apply(pal_get(fb, i), col, rop));
+        }
+    }
+}
 
 STATIC mp_framebuf_p_t formats[] = {
-    [FRAMEBUF_MON_VLSB&0xE0] 	= {mon_setpixel, mon_getpixel},
-    [FRAMEBUF_GS2_HMSB&0xE0] 	= {gs2_setpixel, gs2_getpixel},
-    [FRAMEBUF_GS4_HMSB&0xE0] 	= {gs4_setpixel, gs4_getpixel},
-    [FRAMEBUF_GS8_H&0xE0] 		= {gs8_setpixel, gs8_getpixel},
-    [FRAMEBUF_RGB565&0xE0] 	    = {rgb_setpixel, rgb_getpixel},
-    [FRAMEBUF_ST7302&0xE0] 	    = {st7302_setpixel, st7302_getpixel},
+    [FRAMEBUF_MON_VLSB&0xE0] 	= {mon_setpixel, mon_getpixel, mon_fill_rect},
+    [FRAMEBUF_GS2_HMSB&0xE0] 	= {gs2_setpixel, gs2_getpixel, gs2_fill_rect},
+    [FRAMEBUF_GS4_HMSB&0xE0] 	= {gs4_setpixel, gs4_getpixel, gs4_fill_rect},
+    [FRAMEBUF_GS8_H&0xE0] 		= {gs8_setpixel, gs8_getpixel, gs8_fill_rect},
+    [FRAMEBUF_RGB565&0xE0] 	    = {rgb_setpixel, rgb_getpixel, rgb_fill_rect},
+    [FRAMEBUF_ST7302&0xE0] 	    = {st7302_setpixel, st7302_getpixel, st7302_fill_rect},
+    [FRAMEBUF_RGB332&0xE0] 	    = {rgbc_setpixel, rgbc_getpixel, rgbc_fill_rect},
+    [FRAMEBUF_PAL2&0xE0] 	    = {pal_setpixel, pal_getpixel, pal_fill_rect},
     
 };
 
+// A banded buffer holds screen rows band_y..band_y+band_h-1 only; drawing
+// takes screen coordinates and is clipped to the band.
+
+// Buffer row of screen row y, or -1 outside the band.
+static inline int band_row(const mp_obj_framebuf_t *fb, int y) {
+    if (fb->band_h == 0) {
+        return y;
+    }
+    y -= fb->band_y;
+    return 0 <= y && y < fb->band_h ? y : -1;
+}
+
+// Clips screen rows y0..y1-1 to the band, returning the rows cut at the top.
+static inline int band_clip(const mp_obj_framebuf_t *fb, int *y0, int *y1) {
+    if (fb->band_h == 0) {
+        return 0;
+    }
+    int top = MAX(*y0, fb->band_y);
+    int skip = top - *y0;
+    *y0 = top;
+    *y1 = MIN(*y1, fb->band_y + fb->band_h);
+    return skip;
+}
+
+// A tiled buffer stores whole-byte pixels in square tiles of 1 << tile
+// pixels a side, tile after tile along the lines of tiles and each tile
+// line by line, so columns and rotated drawing stay within a few cache
+// lines instead of a full line apart.
+
+// Bytes of a pixel of a format that can be tiled, or 0.
+STATIC int tile_pixel_bytes(uint8_t format) {
+    switch (format & 0xE3) {
+        case FRAMEBUF_RGB565:
+        case FRAMEBUF_RGB565SW:
+            return 2;
+        case FRAMEBUF_RGB888:
+        case FRAMEBUF_RGB666:
+            return 3;
+        case FRAMEBUF_RGB8888:
+            return 4;
+        case FRAMEBUF_GS8_V:
+        case FRAMEBUF_GS8_H:
+        case FRAMEBUF_RGB332:
+        case FRAMEBUF_PAL8:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Whether lines run along y. GS8 ignores MV, GS8_H keeps columns contiguous.
+static inline bool tile_swap(uint8_t format) {
+    if ((format & 0xE0) == (FRAMEBUF_GS8_H & 0xE0)) {
+        return (format & 0x02) != 0;
+    }
+    return (format & FRAMEBUF_MV) != 0;
+}
+
+// Pixel a along a line of line b.
+static inline uint8_t *tile_addr(const mp_obj_framebuf_t *fb, int a, int b) {
+    int t = fb->tile, mask = (1 << t) - 1;
+    size_t i = (((size_t)(b >> t) * (fb->stride >> t) + (a >> t)) << (2 * t)) + ((b & mask) << t) + (a & mask);
+    return &((uint8_t *)fb->buf)[i * tile_pixel_bytes(fb->format)];
+}
+
+// Pixel values as stored by the line functions of each format.
+static inline void tile_store(uint8_t *p, uint8_t format, uint32_t col) {
+    switch (format & 0xE3) {
+        case FRAMEBUF_RGB565: {
+            uint16_t v = col;
+            memcpy(p, &v, 2);
+            break;
+        }
+        case FRAMEBUF_RGB565SW:
+            p[0] = col >> 8;
+            p[1] = col;
+            break;
+        case FRAMEBUF_RGB888:
+            p[0] = col >> 16;
+            p[1] = col >> 8;
+            p[2] = col;
+            break;
+        case FRAMEBUF_RGB666:
+            p[0] = (col >> 16) & 0xfc;
+            p[1] = (col >> 8) & 0xfc;
+            p[2] = col & 0xfc;
+            break;
+        case FRAMEBUF_RGB8888:
+            memcpy(p, &col, 4);
+            break;
+        default:
+            p[0] = col;
+            break;
+    }
+}
+
+static inline uint32_t tile_load(const uint8_t *p, uint8_t format) {
+    switch (format & 0xE3) {
+        case FRAMEBUF_RGB565: {
+            uint16_t v;
+            memcpy(&v, p, 2);
+            return v;
+        }
+        case FRAMEBUF_RGB565SW:
+            return (p[0] << 8) | p[1];
+        case FRAMEBUF_RGB888:
+        case FRAMEBUF_RGB666:
+            return (p[0] << 16) | (p[1] << 8) | p[2];
+        case FRAMEBUF_RGB8888: {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            return v;
+        }
+        default:
+            return p[0];
+    }
+}
+
+STATIC void tiled_setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col) {
+    bool swap = tile_swap(fb->format);
+    tile_store(tile_addr(fb, swap ? y : x, swap ? x : y), fb->format, col);
+}
+
+STATIC uint32_t tiled_getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
+    bool swap = tile_swap(fb->format);
+    return tile_load(tile_addr(fb, swap ? y : x, swap ? x : y), fb->format);
+}
+
+// Fills n pixels from p, which lie in one line of a tile.
+STATIC void tile_span(uint8_t *p, int n, int bpp, uint8_t format, uint32_t col, int rop) {
+    if (rop != FRAMEBUF_ROP_COPY) {
+        for (; n; --n, p += bpp) {
+            tile_store(p, format, rop_apply(tile_load(p, format), col, rop));
+        }
+        return;
+    }
+    if (bpp == 1) {
+        memset(p, col, n);
+        return;
+    }
+    tile_store(p, format, col);
+    for (int i = 1; i < n; i++) {
+        memcpy(&p[i * bpp], p, bpp);
+    }
+}
+
+STATIC void tiled_fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col, int rop) {
+    if (tile_swap(fb->format)) {
+        int t = x;
+        x = y;
+        y = t;
+        t = w;
+        w = h;
+        h = t;
+    }
+    int bpp = tile_pixel_bytes(fb->format);
+    int size = 1 << fb->tile;
+    for (int b = y; b < y + h; b++) {
+        for (int a = x; a < x + w;) {
+            int n = MIN(x + w, (a & ~(size - 1)) + size) - a;
+            tile_span(tile_addr(fb, a, b), n, bpp, fb->format, col, rop);
+            a += n;
+        }
+    }
+}
+
 static inline void setpixel(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col) {
     if (0 <= x && x < fb->width && 0 <= y && y < fb->height){
         if ((fb->format&FRAMEBUF_MX)==FRAMEBUF_MX)
             x=fb->width-x-1;
         if ((fb->format&FRAMEBUF_MY)==FRAMEBUF_MY)
             y=fb->height-y-1;
-        if (x>=0 && x<fb->width && y>=0 && y<fb->height)
-            formats[fb->format&0xE0].setpixel(fb, x, y, col);
+        y=band_row(fb, y);
+        if (x>=0 && x<fb->width && y>=0 && y<fb->height){
+            if (fb->tile)
+                tiled_setpixel(fb, x, y, col);
+            else
+                formats[fb->format&0xE0].setpixel(fb, x, y, col);
+        }
     }
 }
 
@@ -578,6 +1253,11 @@ static inline uint32_t getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
             x=fb->width-x-1;
         if ((fb->format&FRAMEBUF_MY)==FRAMEBUF_MY)
             y=fb->height-y-1;
+        y=band_row(fb, y);
+        if (y<0)
+            return 0;
+        if (fb->tile)
+            return tiled_getpixel(fb, x, y);
         return formats[fb->format&0xE0].getpixel(fb, x, y);
     }else{
         return 0;
@@ -585,58 +1265,75 @@ static inline uint32_t getpixel(const mp_obj_framebuf_t *fb, int x, int y) {
     
 }
 
-STATIC void fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col) {
+STATIC void fill_rect_rop(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col, int rop) {
     if (h < 1 || w < 1 || x + w <= 0 || y + h <= 0 || y >= fb->height || x >= fb->width) {
         // No operation needed.
         return;
     }
-    for (int xx = x; xx < x + w; xx++) {
-        for (int yy = y; yy < y + h; yy++) {
-            setpixel(fb, xx, yy, col);
-        }
+    // Clip to the buffer, then mirror the whole rectangle for MX/MY.
+    int xend = MIN(fb->width, x + w);
+    int yend = MIN(fb->height, y + h);
+    x = MAX(x, 0);
+    y = MAX(y, 0);
+    band_clip(fb, &y, &yend);
+    if (y >= yend) {
+        return;
+    }
+    w = xend - x;
+    h = yend - y;
+    if ((fb->format&FRAMEBUF_MX)==FRAMEBUF_MX)
+        x=fb->width-x-w;
+    if ((fb->format&FRAMEBUF_MY)==FRAMEBUF_MY)
+        y=fb->height-y-h;
+    y = band_row(fb, y);
+    if (fb->tile) {
+        tiled_fill_rect(fb, x, y, w, h, col, rop);
+    } else {
+        formats[fb->format&0xE0].fill_rect(fb, x, y, w, h, col, rop);
     }
 }
 
-STATIC mp_obj_t framebuf_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
-    mp_arg_check_num(n_args, n_kw, 4, 5, false);
-
-    mp_obj_framebuf_t *o = m_new_obj(mp_obj_framebuf_t);
-    o->base.type = type;
-    o->buf_obj = args[0];
+STATIC void fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col) {
+    fill_rect_rop(fb, x, y, w, h, col, FRAMEBUF_ROP_COPY);
+}
 
-    mp_buffer_info_t bufinfo;
-    mp_get_buffer_raise(args[0], &bufinfo, MP_BUFFER_WRITE);
-    o->buf = bufinfo.buf;
+// Bits of a pixel value in each format.
+STATIC uint32_t pixel_bits(uint8_t format) {
+    switch (format & 0xE0) {
+        case FRAMEBUF_GS2_HMSB & 0xE0:
+            return 0x03;
+        case FRAMEBUF_GS4_HMSB & 0xE0:
+            return 0x0f;
+        case FRAMEBUF_GS8_H & 0xE0:
+            return 0xff;
+        case FRAMEBUF_RGB565 & 0xE0:
+            return (format & 0x02) == 0 ? 0xffff : (format & 0x01) == 0 ? 0xffffff : 0xffffffff;
+        case FRAMEBUF_RGB332 & 0xE0:
+            return (format & 0x02) != 0 ? 0xfcfcfc : (format & 0x01) != 0 ? 0xfff : 0xff;
+        case FRAMEBUF_PAL2 & 0xE0:
+            return (1 << pal_bits(format)) - 1;
+        default:
+            return 0x01;
+    }
+}
 
-    o->width = mp_obj_get_int(args[1]);
-    o->height = mp_obj_get_int(args[2]);
-    o->format = mp_obj_get_int(args[3]);
-    if (n_args > 4) {
-        o->stride = mp_obj_get_int(args[4]);
-    } else {
-        if ((o->format & FRAMEBUF_MV) == 0x00){
-            o->stride = o->width;
-        }else{
-            o->stride = o->height;
+// setpixel() through a raster op. Mono values are 0/1 as in setpixel().
+STATIC void setpixel_rop(const mp_obj_framebuf_t *fb, int x, int y, uint32_t col, int rop) {
+    if (rop != FRAMEBUF_ROP_COPY) {
+        uint32_t bits = pixel_bits(fb->format);
+        if (bits == 0x01) {
+            col = col != 0;
         }
+        col = rop_apply(getpixel(fb, x, y), col, rop) & bits;
     }
-    //font style seting
-    o->font_set.f_style=0x11;
-    o->font_set.scale=1;   
-    o->font_set.rotate=0;     
-    o->font_set.inverse=0;  
-    o->font_set.transparent=1;
-    o->font_set.bg_col=0;
-    o->font_file=NULL;
-    o->font_inf.Font_Type=0;
-    o->font_inf.Base_Addr12=0;		//xuanzhuan 0,12dot font no exist
-    o->font_inf.Base_Addr16=0;  	//xuanzhuan 0,16dot font no exist
-    o->font_inf.Base_Addr24=0;		//xuanzhuan 0,24dot font no exist
-    o->font_inf.Base_Addr32=0;		//xuanzhuan 0,32dot font no exist
-    //确认垂直方式也需要处理stride，另外定义buffer时也需要处理
-    switch (o->format&0xE0) {
+    setpixel(fb, x, y, col);
+}
+
+// Rounds stride up to whole bytes of the format; raises for an unknown one.
+STATIC mp_int_t format_stride(uint8_t format, mp_int_t stride) {
+    switch (format&0xE0) {
         case FRAMEBUF_ST7302:
-            o->stride = (o->stride + 11) / 12 * 12;
+            stride = (stride + 11) / 12 * 12;
             break;
         case FRAMEBUF_GS8_H:
         case FRAMEBUF_GS8_V:
@@ -645,70 +1342,279 @@ STATIC mp_obj_t framebuf_make_new(const mp_obj_type_t *type, size_t n_args, size
         case FRAMEBUF_RGB888:
         case FRAMEBUF_RGB8888:
             break;
+        case FRAMEBUF_RGB332:
+            if ((format & 0x03) == 0x03) {
+                mp_raise_ValueError(MP_ERROR_TEXT("invalid format"));
+            }
+            // RGB444 lines hold whole pixel pairs.
+            if ((format & 0x03) == 0x01) {
+                stride = (stride + 1) & ~1;
+            }
+            break;
+        case FRAMEBUF_PAL2:
+            if ((format & 0x03) == 0x03) {
+                mp_raise_ValueError(MP_ERROR_TEXT("invalid format"));
+            }
+            {
+                int ppb = 8 / pal_bits(format);
+                stride = (stride + ppb - 1) / ppb * ppb;
+            }
+            break;
         case FRAMEBUF_MON_VLSB:
         case FRAMEBUF_MON_VMSB:
         case FRAMEBUF_MON_HLSB:
         case FRAMEBUF_MON_HMSB:
-            o->stride = (o->stride + 7) & ~7;
+            stride = (stride + 7) & ~7;
             break;
         case FRAMEBUF_GS2_VLSB:
         case FRAMEBUF_GS2_VMSB:
         case FRAMEBUF_GS2_HLSB:
         case FRAMEBUF_GS2_HMSB:
-            o->stride = (o->stride + 3) & ~3;
+            stride = (stride + 3) & ~3;
             break;
         case FRAMEBUF_GS4_VLSB:
         case FRAMEBUF_GS4_VMSB:
         case FRAMEBUF_GS4_HLSB:
         case FRAMEBUF_GS4_HMSB:
-            o->stride = (o->stride + 1) & ~1;
+            stride = (stride + 1) & ~1;
             break;
         default:
             mp_raise_ValueError(MP_ERROR_TEXT("invalid format"));
     }
-    //mp_printf(&mp_plat_print,"w=%d,h=%d,f=%d,s=%d\n\r",o->width,o->height,o->format,o->stride);
-    return MP_OBJ_FROM_PTR(o);
+    return stride;
 }
 
-STATIC void framebuf_args(const mp_obj_t *args_in, mp_int_t *args_out, int n) {
-    for (int i = 0; i < n; ++i) {
+// Raises unless the sizes fit the fields and every pixel of the buffer can
+// be indexed, with room for the 4 bytes of an RGB8888 pixel.
+STATIC void framebuf_check_size(uint8_t format, mp_int_t width, mp_int_t height, mp_int_t stride) {
+    if (width < 0 || height < 0 || stride < 0
+        || width > FRAMEBUF_SIZE_MAX || height > FRAMEBUF_SIZE_MAX || stride > FRAMEBUF_SIZE_MAX) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid size"));
+    }
+    // The last pixel is at most a line's length past the start of the last line.
+    mp_int_t lines = tile_swap(format) ? width : height;
+    mp_int_t room = FRAMEBUF_INDEX_MAX / 4 - MAX(width, height);
+    if (room < 0 || (lines && stride > room / lines)) {
+        mp_raise_ValueError(MP_ERROR_TEXT("FrameBuffer too large"));
+    }
+}
+
+// Defined with the memory layout below.
+STATIC size_t band_bytes(const mp_obj_framebuf_t *fb, int h);
+
+// Makes the buffer hold screen rows y..y+h-1; raises unless its memory
+// holds h rows.
+STATIC void framebuf_set_band(mp_obj_framebuf_t *self, mp_int_t y, mp_int_t h) {
+    if ((self->format & (FRAMEBUF_MY | FRAMEBUF_MV)) != 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bands need a format without MY or MV"));
+    }
+    if (y < 0 || y >= self->height || h < 1 || h > self->height) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid band"));
+    }
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(self->buf_obj, &bufinfo, MP_BUFFER_READ);
+    if (bufinfo.len < band_bytes(self, h)) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buffer too small"));
+    }
+    self->band_y = y;
+    self->band_h = (y == 0 && h == self->height) ? 0 : h;
+}
+
+STATIC mp_obj_t framebuf_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
+    mp_arg_check_num(n_args, n_kw, 4, 6, false);
+
+    mp_obj_framebuf_t *o = m_new_obj(mp_obj_framebuf_t);
+    o->base.type = type;
+    o->buf_obj = args[0];
+
+    // Read-only memory such as frozen bytes is taken as is, for blit sources.
+    mp_buffer_info_t bufinfo;
+    o->read_only = !mp_get_buffer(args[0], &bufinfo, MP_BUFFER_WRITE);
+    if (o->read_only) {
+        mp_get_buffer_raise(args[0], &bufinfo, MP_BUFFER_READ);
+    }
+    o->buf = bufinfo.buf;
+
+    mp_int_t width = mp_obj_get_int(args[1]);
+    mp_int_t height = mp_obj_get_int(args[2]);
+    mp_int_t stride;
+    o->format = mp_obj_get_int(args[3]);
+    if (n_args > 4) {
+        stride = mp_obj_get_int(args[4]);
+    } else {
+        if ((o->format & FRAMEBUF_MV) == 0x00){
+            stride = width;
+        }else{
+            stride = height;
+        }
+    }
+    //font style seting
+    o->font_set.f_style=0x11;
+    o->font_set.scale=1;   
+    o->font_set.rotate=0;     
+    o->font_set.inverse=0;  
+    o->font_set.transparent=1;
+    o->font_set.bg_col=0;
+    o->font_file=NULL;
+    o->band_y=0;
+    o->band_h=0;
+    o->tile=0;
+    o->font_inf.Font_Type=0;
+    o->font_inf.Base_Addr12=0;		//xuanzhuan 0,12dot font no exist
+    o->font_inf.Base_Addr16=0;  	//xuanzhuan 0,16dot font no exist
+    o->font_inf.Base_Addr24=0;		//xuanzhuan 0,24dot font no exist
+    o->font_inf.Base_Addr32=0;		//xuanzhuan 0,32dot font no exist
+    //确认垂直方式也需要处理stride，另外定义buffer时也需要处理
+    stride = format_stride(o->format, stride);
+    framebuf_check_size(o->format, width, height, stride);
+    o->width = width;
+    o->height = height;
+    o->stride = stride;
+    // PAL buffers start with a grey ramp.
+    o->palette = NULL;
+    if ((o->format & 0xE0) == (FRAMEBUF_PAL2 & 0xE0)) {
+        int n = 1 << pal_bits(o->format);
+        o->palette = m_new(uint32_t, n);
+        for (int i = 0; i < n; i++) {
+            o->palette[i] = i * 255 / (n - 1) * 0x010101;
+        }
+    }
+    // A sixth argument makes a banded buffer from the start, so nothing is
+    // drawn at full height into a buffer that only holds a band.
+    if (n_args > 5) {
+        framebuf_set_band(o, 0, mp_obj_get_int(args[5]));
+    }
+    //mp_printf(&mp_plat_print,"w=%d,h=%d,f=%d,s=%d\n\r",o->width,o->height,o->format,o->stride);
+    return MP_OBJ_FROM_PTR(o);
+}
+
+STATIC void framebuf_args(const mp_obj_t *args_in, mp_int_t *args_out, int n) {
+    for (int i = 0; i < n; ++i) {
         args_out[i] = mp_obj_get_int(args_in[i + 1]);
     }
 }
 
+// Checks a buffer that is about to be drawn into.
+STATIC mp_obj_framebuf_t *framebuf_writable(mp_obj_framebuf_t *fb) {
+    if (fb->read_only) {
+        mp_raise_ValueError(MP_ERROR_TEXT("FrameBuffer is read-only"));
+    }
+    return fb;
+}
+
 STATIC mp_int_t framebuf_get_buffer(mp_obj_t self_in, mp_buffer_info_t *bufinfo, mp_uint_t flags) {
-    (void)flags;
     mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(self_in);
+    if ((flags & MP_BUFFER_WRITE) && self->read_only) {
+        return 1;
+    }
     bufinfo->buf = self->buf;
+    // The pixel size doesn't depend on the orientation.
+    uint8_t format = self->format & ~(FRAMEBUF_MX | FRAMEBUF_MY | FRAMEBUF_MV);
     u_int8_t size=1;
-    if ((self->format == FRAMEBUF_RGB565)||(self->format == FRAMEBUF_RGB565)){
+    if ((format == FRAMEBUF_RGB565)||(format == FRAMEBUF_RGB565SW)){
         size=2;
-    }else if(self->format == FRAMEBUF_RGB888){
+    }else if(format == FRAMEBUF_RGB888){
         size=3;
-    }else if(self->format == FRAMEBUF_RGB8888){
+    }else if(format == FRAMEBUF_RGB8888){
         size=4;
+    }else if(format == FRAMEBUF_RGB666){
+        size=3;
+    }
+    int rows = self->band_h ? self->band_h : self->height;
+    // Lines run down the columns with MV, and always for GS8_H.
+    if (tile_swap(self->format)) {
+        rows = self->width;
+    }
+    if (self->tile) {
+        // whole tiles
+        rows = (rows + (1 << self->tile) - 1) >> self->tile << self->tile;
+    }
+    bufinfo->len = self->stride * rows * size;
+    if(format == FRAMEBUF_RGB444){
+        bufinfo->len = bufinfo->len * 3 / 2;
+    }else if((self->format&0xE0) == (FRAMEBUF_PAL2&0xE0)){
+        bufinfo->len = bufinfo->len * pal_bits(self->format) / 8;
     }
-    bufinfo->len = self->stride * self->height * size;
     bufinfo->typecode = 'B'; // view framebuf as bytes
     return 0;
 }
 
 STATIC mp_obj_t framebuf_fill(mp_obj_t self_in, mp_obj_t col_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(self_in));
     mp_int_t col = mp_obj_get_int(col_in);
     fill_rect(self, 0, 0, self->width, self->height, col);
     return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_2(framebuf_fill_obj, framebuf_fill);
 
+STATIC mp_obj_t framebuf_band(size_t n_args, const mp_obj_t *args) {
+    // band(y[, h]): make the buffer hold screen rows y..y+h-1 only, or move
+    // the band to y keeping its height. Drawing still takes screen
+    // coordinates; band(0, height) holds the whole screen again.
+    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_int_t y = mp_obj_get_int(args[1]);
+    mp_int_t h = self->band_h ? self->band_h : self->height;
+    if (n_args > 2) {
+        h = mp_obj_get_int(args[2]);
+    }
+    framebuf_set_band(self, y, h);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_band_obj, 2, 3, framebuf_band);
+
+STATIC mp_obj_t framebuf_tile(mp_obj_t self_in, mp_obj_t size_in) {
+    // tile(size): store the buffer in square tiles of 8 or 16 pixels, or in
+    // lines again for 0. The memory is taken as it is, so set the layout
+    // before drawing; stride is rounded up to whole tiles, and back to what
+    // it was for lines.
+    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_int_t size = mp_obj_get_int(size_in);
+    if (size == 0) {
+        if (self->tile) {
+            self->stride = self->line_stride;
+            self->tile = 0;
+        }
+        return mp_const_none;
+    }
+    if (size != 8 && size != 16) {
+        mp_raise_ValueError(MP_ERROR_TEXT("tile size must be 0, 8 or 16"));
+    }
+    int bpp = tile_pixel_bytes(self->format);
+    if (bpp == 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("tiles need whole-byte pixels"));
+    }
+    int t = size == 8 ? 3 : 4;
+    int rows = self->band_h ? self->band_h : self->height;
+    bool swap = tile_swap(self->format);
+    fb_size_t line_stride = self->tile ? self->line_stride : self->stride;
+    mp_int_t stride = MAX(line_stride, swap ? rows : self->width);
+    stride = (stride + size - 1) & ~(size - 1);
+    mp_int_t lines = ((swap ? self->width : rows) + size - 1) & ~(size - 1);
+    framebuf_check_size(self->format, swap ? lines : self->width, swap ? self->height : lines, stride);
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(self->buf_obj, &bufinfo, MP_BUFFER_READ);
+    if (bufinfo.len < (size_t)stride * lines * bpp) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buffer too small"));
+    }
+    self->line_stride = line_stride;
+    self->stride = stride;
+    self->tile = t;
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(framebuf_tile_obj, framebuf_tile);
+
 STATIC mp_obj_t framebuf_fill_rect(size_t n_args, const mp_obj_t *args_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args_in[0]));
     mp_int_t args[5]; // x, y, w, h, col
     framebuf_args(args_in, args, 5);
-    fill_rect(self, args[0], args[1], args[2], args[3], args[4]);
+    mp_int_t rop = FRAMEBUF_ROP_COPY;
+    if (n_args > 6) {
+        rop = mp_obj_get_int(args_in[6]);
+    }
+    fill_rect_rop(self, args[0], args[1], args[2], args[3], args[4], rop);
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_fill_rect_obj, 6, 6, framebuf_fill_rect);
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_fill_rect_obj, 6, 7, framebuf_fill_rect);
 
 STATIC mp_obj_t framebuf_pixel(size_t n_args, const mp_obj_t *args) {
     mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
@@ -720,7 +1626,7 @@ STATIC mp_obj_t framebuf_pixel(size_t n_args, const mp_obj_t *args) {
             return MP_OBJ_NEW_SMALL_INT(getpixel(self, x, y));
         } else {
             // set
-            setpixel(self, x, y, mp_obj_get_int(args[3]));
+            setpixel(framebuf_writable(self), x, y, mp_obj_get_int(args[3]));
         }
     }
     return mp_const_none;
@@ -730,7 +1636,7 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_pixel_obj, 3, 4, framebuf_pi
 STATIC mp_obj_t framebuf_hline(size_t n_args, const mp_obj_t *args_in) {
     (void)n_args;
 
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args_in[0]));
     mp_int_t args[4]; // x, y, w, col
     framebuf_args(args_in, args, 4);
 
@@ -743,7 +1649,7 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_hline_obj, 5, 5, framebuf_hl
 STATIC mp_obj_t framebuf_vline(size_t n_args, const mp_obj_t *args_in) {
     (void)n_args;
 
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args_in[0]));
     mp_int_t args[4]; // x, y, h, col
     framebuf_args(args_in, args, 4);
 
@@ -754,21 +1660,35 @@ STATIC mp_obj_t framebuf_vline(size_t n_args, const mp_obj_t *args_in) {
 
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_vline_obj, 5, 5, framebuf_vline);
 
+// Rectangle outline of the given stroke, or filled.
+STATIC void draw_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col, bool fill, int stroke, int rop) {
+    // The sides of an outline don't overlap, so XOR draws each pixel once.
+    if (fill || 2 * stroke >= MIN(w, h)) {
+        fill_rect_rop(fb, x, y, w, h, col, rop);
+    } else {
+        fill_rect_rop(fb, x, y, w, stroke, col, rop);
+        fill_rect_rop(fb, x, y + h - stroke, w, stroke, col, rop);
+        fill_rect_rop(fb, x, y + stroke, stroke, h - 2 * stroke, col, rop);
+        fill_rect_rop(fb, x + w - stroke, y + stroke, stroke, h - 2 * stroke, col, rop);
+    }
+}
+
 STATIC mp_obj_t framebuf_rect(size_t n_args, const mp_obj_t *args_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args_in[0]));
     mp_int_t args[5]; // x, y, w, h, col
     framebuf_args(args_in, args, 5);
-    if (n_args > 6 && mp_obj_is_true(args_in[6])) {
-        fill_rect(self, args[0], args[1], args[2], args[3], args[4]);
-    } else {
-        fill_rect(self, args[0], args[1], args[2], 1, args[4]);
-        fill_rect(self, args[0], args[1] + args[3] - 1, args[2], 1, args[4]);
-        fill_rect(self, args[0], args[1], 1, args[3], args[4]);
-        fill_rect(self, args[0] + args[2] - 1, args[1], 1, args[3], args[4]);
+    mp_int_t stroke = 1;
+    if (n_args > 7) {
+        stroke = MAX(1, mp_obj_get_int(args_in[7]));
+    }
+    mp_int_t rop = FRAMEBUF_ROP_COPY;
+    if (n_args > 8) {
+        rop = mp_obj_get_int(args_in[8]);
     }
+    draw_rect(self, args[0], args[1], args[2], args[3], args[4], n_args > 6 && mp_obj_is_true(args_in[6]), stroke, rop);
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_rect_obj, 6, 6, framebuf_rect);
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_rect_obj, 6, 9, framebuf_rect);
 
 STATIC void line(const mp_obj_framebuf_t *fb, mp_int_t x1, mp_int_t y1, mp_int_t x2, mp_int_t y2, mp_int_t col) {
     mp_int_t dx = x2 - x1;
@@ -830,18 +1750,249 @@ STATIC void line(const mp_obj_framebuf_t *fb, mp_int_t x1, mp_int_t y1, mp_int_t
     }
 }
 
-STATIC mp_obj_t framebuf_line(size_t n_args, const mp_obj_t *args_in) {
-    (void)n_args;
+// Fill rules for poly(..., fill=True, rule).
+#define POLY_EVEN_ODD (0)
+#define POLY_NON_ZERO (1)
+
+STATIC mp_int_t poly_rule(mp_obj_t rule_in) {
+    mp_int_t rule = mp_obj_get_int(rule_in);
+    if (rule != POLY_EVEN_ODD && rule != POLY_NON_ZERO) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid fill rule"));
+    }
+    return rule;
+}
+
+// x positions in the active edge table are 16.16 fixed point, held in 64
+// bits so that widths of 32768 and up don't overflow.
+#define POLY_FIX_SHIFT (16)
+#define POLY_FIX_ONE (1 << POLY_FIX_SHIFT)
+
+// One polygon edge for the scanline filler. An edge is active for rows
+// y_top..y_bot inclusive: rows above y_bot cross the scanline at x, the
+// y_bot row only contributes the bottom vertex (or the whole edge if it is
+// horizontal), which fills in the boundary pixels the half-open rule misses.
+typedef struct _poly_edge_t {
+    int64_t x;      // x at the current scanline, stepped by dxdy
+    int64_t dxdy;
+    mp_int_t x_top, y_top;
+    mp_int_t x_bot, y_bot;  // for horizontal edges x_top <= x_bot
+    int poly;       // index of the polygon (and colour) the edge belongs to
+    int8_t dir;     // +1 downwards, -1 upwards, 0 horizontal
+} poly_edge_t;
+
+// Sets up the edge from (px1, py1) to (px2, py2) of polygon poly.
+STATIC void poly_set_edge(poly_edge_t *e, mp_int_t px1, mp_int_t py1, mp_int_t px2, mp_int_t py2, int poly) {
+    e->poly = poly;
+    if (py1 == py2) {
+        e->dir = 0;
+        e->x_top = MIN(px1, px2);
+        e->x_bot = MAX(px1, px2);
+        e->y_top = e->y_bot = py1;
+        e->dxdy = 0;
+    } else {
+        if (py1 < py2) {
+            e->dir = 1;
+            e->x_top = px1;
+            e->y_top = py1;
+            e->x_bot = px2;
+            e->y_bot = py2;
+        } else {
+            e->dir = -1;
+            e->x_top = px2;
+            e->y_top = py2;
+            e->x_bot = px1;
+            e->y_bot = py1;
+        }
+        e->dxdy = (int64_t)(e->x_bot - e->x_top) * POLY_FIX_ONE / (e->y_bot - e->y_top);
+    }
+}
+
+// Shell sort of the edge table by y_top: no recursion and no extra memory.
+STATIC void poly_sort_edges(poly_edge_t *edges, int n_edges) {
+    for (int gap = n_edges / 2; gap > 0; gap /= 2) {
+        for (int i = gap; i < n_edges; i++) {
+            poly_edge_t tmp = edges[i];
+            int j = i;
+            for (; j >= gap && edges[j - gap].y_top > tmp.y_top; j -= gap) {
+                edges[j] = edges[j - gap];
+            }
+            edges[j] = tmp;
+        }
+    }
+}
+
+// Insertion sort of the active edges by polygon, then x. The list is almost
+// always already in order from the previous row, so this is linear in practice.
+STATIC void poly_sort_active(poly_edge_t **active, int n_active) {
+    for (int i = 1; i < n_active; i++) {
+        poly_edge_t *e = active[i];
+        int j = i;
+        for (; j > 0 && (active[j - 1]->poly > e->poly || (active[j - 1]->poly == e->poly && active[j - 1]->x > e->x)); j--) {
+            active[j] = active[j - 1];
+        }
+        active[j] = e;
+    }
+}
+
+// Scanline polygon filler: the edges are sorted into an edge table by y_top,
+// moved into an active edge table as the sweep reaches them, and their
+// intersections are stepped incrementally from row to row. Each row emits
+// its spans straight to fill_rect. The edges may come from several polygons,
+// each filled with cols[poly]; within a row the polygons are drawn in order,
+// so later polygons paint over earlier ones.
+STATIC void poly_fill(const mp_obj_framebuf_t *fb, poly_edge_t *edges, int n_edges, const mp_int_t *cols, mp_int_t rule) {
+    poly_sort_edges(edges, n_edges);
+
+    mp_int_t y_max = INT_MIN;
+    for (int i = 0; i < n_edges; i++) {
+        y_max = MAX(y_max, edges[i].y_bot);
+    }
+    // Restrict the sweep to the rows that are visible.
+    mp_int_t row = MAX(edges[0].y_top, 0);
+    y_max = MIN(y_max, fb->height - 1);
+
+    // Small shapes (thick lines, quads) keep the active table on the stack.
+    poly_edge_t *active_small[8];
+    poly_edge_t **active = n_edges <= 8 ? active_small : m_new(poly_edge_t *, n_edges);
+    int n_active = 0;
+    int next = 0;
+    for (; row <= y_max; row++) {
+        // Move the edges reaching this row into the active edge table. Edges
+        // starting above the first visible row are advanced to it directly.
+        while (next < n_edges && edges[next].y_top <= row) {
+            poly_edge_t *e = &edges[next++];
+            if (e->y_bot >= row) {
+                e->x = (int64_t)e->x_top * POLY_FIX_ONE + POLY_FIX_ONE / 2 + (row - e->y_top) * e->dxdy;
+                active[n_active++] = e;
+            }
+        }
+        if (n_active == 0) {
+            if (next == n_edges) {
+                break;
+            }
+            // Skip straight to the next edge.
+            row = edges[next].y_top - 1;
+            continue;
+        }
+        poly_sort_active(active, n_active);
+
+        for (int i = 0; i < n_active;) {
+            int poly = active[i]->poly;
+            mp_int_t col = cols[poly];
+            int end = i;
+            while (end < n_active && active[end]->poly == poly) {
+                end++;
+            }
+
+            // Walk the crossings left to right, filling wherever the winding
+            // number is inside according to the fill rule.
+            mp_int_t winding = 0;
+            mp_int_t span_x = 0;
+            for (int j = i; j < end; j++) {
+                poly_edge_t *e = active[j];
+                if (row == e->y_bot) {
+                    continue;
+                }
+                mp_int_t node = (mp_int_t)(e->x >> POLY_FIX_SHIFT);
+                mp_int_t prev = winding;
+                winding = rule == POLY_NON_ZERO ? winding + e->dir : winding ^ 1;
+                if (prev == 0) {
+                    span_x = node;
+                } else if (winding == 0) {
+                    fill_rect(fb, span_x, row, node - span_x + 1, 1, col);
+                }
+            }
+
+            // Edges ending on this row draw their bottom vertex.
+            for (int j = i; j < end; j++) {
+                poly_edge_t *e = active[j];
+                if (row == e->y_bot) {
+                    if (e->dir == 0) {
+                        fill_rect(fb, e->x_top, row, e->x_bot - e->x_top + 1, 1, col);
+                    } else {
+                        setpixel_checked(fb, e->x_bot, row, col, 1);
+                    }
+                }
+            }
+            i = end;
+        }
+
+        // Retire the edges ending on this row and step the rest to the next one.
+        int n_kept = 0;
+        for (int i = 0; i < n_active; i++) {
+            poly_edge_t *e = active[i];
+            if (row != e->y_bot) {
+                e->x += e->dxdy;
+                active[n_kept++] = e;
+            }
+        }
+        n_active = n_kept;
+    }
+    if (active != active_small) {
+        m_del(poly_edge_t *, active, n_edges);
+    }
+}
+
+STATIC mp_uint_t isqrt(mp_uint_t n) {
+    mp_uint_t root = 0;
+    mp_uint_t bit = (mp_uint_t)1 << (sizeof(mp_uint_t) * 8 - 2);
+    while (bit > n) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+// Integer division rounded to nearest, for d > 0.
+STATIC mp_int_t div_round(mp_int_t n, mp_int_t d) {
+    return n >= 0 ? (n + d / 2) / d : -((-n + d / 2) / d);
+}
+
+// Draws a line of the given width as a quad through the polygon filler,
+// with square ends at the two endpoints.
+STATIC void thick_line(const mp_obj_framebuf_t *fb, mp_int_t x1, mp_int_t y1, mp_int_t x2, mp_int_t y2, mp_int_t col, mp_int_t width) {
+    mp_int_t dx = x2 - x1;
+    mp_int_t dy = y2 - y1;
+    mp_int_t len = isqrt(dx * dx + dy * dy);
+    if (len == 0) {
+        fill_rect(fb, x1 - (width - 1) / 2, y1 - (width - 1) / 2, width, width, col);
+        return;
+    }
+    // The filler includes both boundaries, so the normal is width - 1 long.
+    mp_int_t nx = div_round(-dy * (width - 1), len);
+    mp_int_t ny = div_round(dx * (width - 1), len);
+    mp_int_t ax = nx / 2, ay = ny / 2;
+    mp_int_t bx = ax - nx, by = ay - ny;
+    poly_edge_t edges[4];
+    poly_set_edge(&edges[0], x1 + ax, y1 + ay, x2 + ax, y2 + ay, 0);
+    poly_set_edge(&edges[1], x2 + ax, y2 + ay, x2 + bx, y2 + by, 0);
+    poly_set_edge(&edges[2], x2 + bx, y2 + by, x1 + bx, y1 + by, 0);
+    poly_set_edge(&edges[3], x1 + bx, y1 + by, x1 + ax, y1 + ay, 0);
+    poly_fill(fb, edges, 4, &col, POLY_EVEN_ODD);
+}
 
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+STATIC mp_obj_t framebuf_line(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args_in[0]));
     mp_int_t args[5]; // x1, y1, x2, y2, col
     framebuf_args(args_in, args, 5);
 
-    line(self, args[0], args[1], args[2], args[3], args[4]);
+    if (n_args > 6 && mp_obj_get_int(args_in[6]) > 1) {
+        thick_line(self, args[0], args[1], args[2], args[3], args[4], mp_obj_get_int(args_in[6]));
+    } else {
+        line(self, args[0], args[1], args[2], args[3], args[4]);
+    }
 
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_line_obj, 6, 6, framebuf_line);
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_line_obj, 6, 7, framebuf_line);
 
 // Q2 Q1
 // Q3 Q4
@@ -852,49 +2003,45 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_line_obj, 6, 6, framebuf_lin
 #define ELLIPSE_MASK_Q3 (0x04)
 #define ELLIPSE_MASK_Q4 (0x08)
 
+// Outline points only; filled ellipses are drawn as spans by ellipse_ring().
 STATIC void draw_ellipse_points(const mp_obj_framebuf_t *fb, mp_int_t cx, mp_int_t cy, mp_int_t x, mp_int_t y, mp_int_t col, mp_int_t mask) {
-    if (mask & ELLIPSE_MASK_FILL) {
-        if (mask & ELLIPSE_MASK_Q1) {
-            fill_rect(fb, cx, cy - y, x + 1, 1, col);
-        }
-        if (mask & ELLIPSE_MASK_Q2) {
-            fill_rect(fb, cx - x, cy - y, x + 1, 1, col);
-        }
-        if (mask & ELLIPSE_MASK_Q3) {
-            fill_rect(fb, cx - x, cy + y, x + 1, 1, col);
-        }
-        if (mask & ELLIPSE_MASK_Q4) {
-            fill_rect(fb, cx, cy + y, x + 1, 1, col);
-        }
-    } else {
-        setpixel_checked(fb, cx + x, cy - y, col, mask & ELLIPSE_MASK_Q1);
-        setpixel_checked(fb, cx - x, cy - y, col, mask & ELLIPSE_MASK_Q2);
-        setpixel_checked(fb, cx - x, cy + y, col, mask & ELLIPSE_MASK_Q3);
-        setpixel_checked(fb, cx + x, cy + y, col, mask & ELLIPSE_MASK_Q4);
-    }
+    setpixel_checked(fb, cx + x, cy - y, col, mask & ELLIPSE_MASK_Q1);
+    setpixel_checked(fb, cx - x, cy - y, col, mask & ELLIPSE_MASK_Q2);
+    setpixel_checked(fb, cx - x, cy + y, col, mask & ELLIPSE_MASK_Q3);
+    setpixel_checked(fb, cx + x, cy + y, col, mask & ELLIPSE_MASK_Q4);
 }
 
-STATIC mp_obj_t framebuf_ellipse(size_t n_args, const mp_obj_t *args_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
-    mp_int_t args[5];
-    framebuf_args(args_in, args, 5); // cx, cy, xradius, yradius, col
-    mp_int_t mask = (n_args > 6 && mp_obj_is_true(args_in[6])) ? ELLIPSE_MASK_FILL : 0;
-    if (n_args > 7) {
-        mask |= mp_obj_get_int(args_in[7]) & ELLIPSE_MASK_ALL;
-    } else {
-        mask |= ELLIPSE_MASK_ALL;
+typedef struct _ellipse_ctx_t {
+    const mp_obj_framebuf_t *fb;
+    mp_int_t cx, cy, col, mask;
+    mp_int_t *extent;
+    mp_int_t n_extent;
+} ellipse_ctx_t;
+
+typedef void (*ellipse_point_t)(ellipse_ctx_t *ctx, mp_int_t x, mp_int_t y);
+
+// Steps the midpoint algorithm for an ellipse with radii xr, yr, calling
+// point() for each (x, y) of one quadrant.
+STATIC void ellipse_midpoint(mp_int_t xr, mp_int_t yr, ellipse_point_t point, ellipse_ctx_t *ctx) {
+    if (xr < 0 || yr < 0) {
+        return;
     }
-    mp_int_t two_asquare = 2 * args[2] * args[2];
-    mp_int_t two_bsquare = 2 * args[3] * args[3];
-    mp_int_t x = args[2];
+    if (xr == 0 && yr == 0) {
+        // Neither stopping condition below would ever change.
+        point(ctx, 0, 0);
+        return;
+    }
+    mp_int_t two_asquare = 2 * xr * xr;
+    mp_int_t two_bsquare = 2 * yr * yr;
+    mp_int_t x = xr;
     mp_int_t y = 0;
-    mp_int_t xchange = args[3] * args[3] * (1 - 2 * args[2]);
-    mp_int_t ychange = args[2] * args[2];
+    mp_int_t xchange = yr * yr * (1 - 2 * xr);
+    mp_int_t ychange = xr * xr;
     mp_int_t ellipse_error = 0;
-    mp_int_t stoppingx = two_bsquare * args[2];
+    mp_int_t stoppingx = two_bsquare * xr;
     mp_int_t stoppingy = 0;
     while (stoppingx >= stoppingy) {   // 1st set of points,  y' > -1
-        draw_ellipse_points(self, args[0], args[1], x, y, args[4], mask);
+        point(ctx, x, y);
         y += 1;
         stoppingy += two_asquare;
         ellipse_error += ychange;
@@ -908,14 +2055,14 @@ STATIC mp_obj_t framebuf_ellipse(size_t n_args, const mp_obj_t *args_in) {
     }
     // 1st point set is done start the 2nd set of points
     x = 0;
-    y = args[3];
-    xchange = args[3] * args[3];
-    ychange = args[2] * args[2] * (1 - 2 * args[3]);
+    y = yr;
+    xchange = yr * yr;
+    ychange = xr * xr * (1 - 2 * yr);
     ellipse_error = 0;
     stoppingx = 0;
-    stoppingy = two_asquare * args[3];
+    stoppingy = two_asquare * yr;
     while (stoppingx <= stoppingy) {  // 2nd set of points, y' < -1
-        draw_ellipse_points(self, args[0], args[1], x, y, args[4], mask);
+        point(ctx, x, y);
         x += 1;
         stoppingx += two_bsquare;
         ellipse_error += xchange;
@@ -927,188 +2074,2532 @@ STATIC mp_obj_t framebuf_ellipse(size_t n_args, const mp_obj_t *args_in) {
             ychange += two_asquare;
         }
     }
-    return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_ellipse_obj, 6, 8, framebuf_ellipse);
 
-#if MICROPY_PY_ARRAY && !MICROPY_ENABLE_DYNRUNTIME
-// TODO: poly needs mp_binary_get_size & mp_binary_get_val_array which aren't
-// available in dynruntime.h yet.
+STATIC void ellipse_draw_point(ellipse_ctx_t *ctx, mp_int_t x, mp_int_t y) {
+    draw_ellipse_points(ctx->fb, ctx->cx, ctx->cy, x, y, ctx->col, ctx->mask);
+}
+
+STATIC void ellipse_extent_point(ellipse_ctx_t *ctx, mp_int_t x, mp_int_t y) {
+    if (0 <= y && y < ctx->n_extent && x > ctx->extent[y]) {
+        ctx->extent[y] = x;
+    }
+}
+
+// Ellipses up to this many rows tall keep their extents on the stack.
+#define ELLIPSE_EXTENT_STACK (32)
+
+// Returns the half-width of rows 0..yr of the ellipse as the midpoint
+// algorithm draws it. Small ellipses use scratch, which must hold
+// ELLIPSE_EXTENT_STACK entries; release with ellipse_extents_free().
+STATIC mp_int_t *ellipse_extents(mp_int_t xr, mp_int_t yr, mp_int_t *scratch) {
+    ellipse_ctx_t ctx;
+    ctx.n_extent = yr + 1;
+    ctx.extent = ctx.n_extent <= ELLIPSE_EXTENT_STACK ? scratch : m_new(mp_int_t, ctx.n_extent);
+    for (mp_int_t i = 0; i < ctx.n_extent; i++) {
+        ctx.extent[i] = 0;
+    }
+    ellipse_midpoint(xr, yr, ellipse_extent_point, &ctx);
+    // On narrow ellipses the two point sets can skip rows where they meet;
+    // give those rows the width of the row below.
+    for (mp_int_t i = yr - 1; i >= 0; i--) {
+        ctx.extent[i] = MAX(ctx.extent[i], ctx.extent[i + 1]);
+    }
+    return ctx.extent;
+}
+
+STATIC void ellipse_extents_free(mp_int_t *extent, mp_int_t yr, mp_int_t *scratch) {
+    if (extent != scratch) {
+        m_del(mp_int_t, extent, yr + 1);
+    }
+}
+
+// Clipping applied per row by the span-based curve primitives: either a
+// quadrant mask as for ellipse(), or the sweep of arc() and pie().
+typedef struct _curve_clip_t {
+    mp_int_t mask;
+    bool wedge;
+    bool reflex;                // sweep of more than 180 degrees
+    mp_int_t c0, s0, c1, s1;    // start and end directions, Q14
+} curve_clip_t;
+
+#define CURVE_INF (0x3fffffff)
+
+// sin() of 0..90 degrees in Q14.
+STATIC const uint16_t sin_q14[91] = {
+    0, 286, 572, 857, 1143, 1428, 1713, 1997, 2280, 2563,
+    2845, 3126, 3406, 3686, 3964, 4240, 4516, 4790, 5063, 5334,
+    5604, 5872, 6138, 6402, 6664, 6924, 7182, 7438, 7692, 7943,
+    8192, 8438, 8682, 8923, 9162, 9397, 9630, 9860, 10087, 10311,
+    10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982, 12176, 12365,
+    12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044,
+    14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+    15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+    16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382,
+    16384,
+};
+
+// Direction of an angle in degrees, clockwise from 3 o'clock on screen.
+STATIC void angle_to_vector(mp_int_t deg, mp_int_t *c, mp_int_t *s) {
+    deg %= 360;
+    if (deg < 0) {
+        deg += 360;
+    }
+    if (deg <= 90) {
+        *c = sin_q14[90 - deg];
+        *s = sin_q14[deg];
+    } else if (deg <= 180) {
+        *c = -sin_q14[deg - 90];
+        *s = sin_q14[180 - deg];
+    } else if (deg <= 270) {
+        *c = -sin_q14[270 - deg];
+        *s = -sin_q14[deg - 180];
+    } else {
+        *c = sin_q14[deg - 270];
+        *s = -sin_q14[360 - deg];
+    }
+}
+
+// Sets clip to the clockwise sweep from a0 to a1 degrees. Returns false if
+// there is nothing to draw.
+STATIC bool curve_clip_angles(curve_clip_t *clip, mp_int_t a0, mp_int_t a1) {
+    clip->mask = ELLIPSE_MASK_ALL;
+    clip->wedge = false;
+    mp_int_t sweep = a1 - a0;
+    if (sweep >= 360 || sweep <= -360) {
+        return true;
+    }
+    sweep %= 360;
+    if (sweep < 0) {
+        sweep += 360;
+    }
+    if (sweep == 0) {
+        return false;
+    }
+    clip->wedge = true;
+    clip->reflex = sweep > 180;
+    angle_to_vector(a0, &clip->c0, &clip->s0);
+    angle_to_vector(a1, &clip->c1, &clip->s1);
+    return true;
+}
+
+STATIC mp_int_t floor_div(mp_int_t n, mp_int_t d) {
+    return n >= 0 ? n / d : -((-n + d - 1) / d);
+}
+
+// Solves a * dx + b >= 0 for dx, as the interval [*lo, *hi].
+STATIC void half_plane_interval(mp_int_t a, mp_int_t b, mp_int_t *lo, mp_int_t *hi) {
+    *lo = -CURVE_INF;
+    *hi = CURVE_INF;
+    if (a > 0) {
+        *lo = -floor_div(b, a);
+    } else if (a < 0) {
+        *hi = floor_div(b, -a);
+    } else if (b < 0) {
+        *lo = CURVE_INF;
+        *hi = -CURVE_INF;
+    }
+}
+
+// Computes the parts of row dy (relative to the centre) that pass the clip,
+// as ordered, disjoint (lo, hi) pairs relative to the centre. Returns the
+// number of pairs.
+STATIC int curve_clip_row(const curve_clip_t *clip, mp_int_t dy, mp_int_t *out) {
+    if (clip->wedge) {
+        // Inside means cross(d0, p) >= 0 and cross(p, d1) >= 0, p = (dx, dy).
+        mp_int_t lo0, hi0, lo1, hi1;
+        half_plane_interval(-clip->s0, clip->c0 * dy, &lo0, &hi0);
+        half_plane_interval(clip->s1, -clip->c1 * dy, &lo1, &hi1);
+        if (!clip->reflex) {
+            out[0] = MAX(lo0, lo1);
+            out[1] = MIN(hi0, hi1);
+            return out[0] <= out[1];
+        }
+        // A sweep over 180 degrees is the union of the two half planes.
+        if (lo0 > hi0) {
+            lo0 = lo1;
+            hi0 = hi1;
+        } else if (lo1 > hi1) {
+            lo1 = lo0;
+            hi1 = hi0;
+        }
+        if (lo0 > hi0) {
+            return 0;
+        }
+        if (lo1 < lo0) {
+            mp_int_t t = lo0;
+            lo0 = lo1;
+            lo1 = t;
+            t = hi0;
+            hi0 = hi1;
+            hi1 = t;
+        }
+        if (lo1 <= hi0 + 1) {
+            out[0] = lo0;
+            out[1] = MAX(hi0, hi1);
+            return 1;
+        }
+        out[0] = lo0;
+        out[1] = hi0;
+        out[2] = lo1;
+        out[3] = hi1;
+        return 2;
+    }
+    mp_int_t left = 0, right = 0;
+    if (dy <= 0) {
+        left |= clip->mask & ELLIPSE_MASK_Q2;
+        right |= clip->mask & ELLIPSE_MASK_Q1;
+    }
+    if (dy >= 0) {
+        left |= clip->mask & ELLIPSE_MASK_Q3;
+        right |= clip->mask & ELLIPSE_MASK_Q4;
+    }
+    if (!left && !right) {
+        return 0;
+    }
+    out[0] = left ? -CURVE_INF : 0;
+    out[1] = right ? CURVE_INF : 0;
+    return 1;
+}
+
+// Fills x0..x1 of row y except for the hole hx0..hx1 (none if hx0 > hx1),
+// limited to the clip intervals. All x are relative to cx.
+STATIC void fill_row_clipped(const mp_obj_framebuf_t *fb, mp_int_t cx, mp_int_t y, mp_int_t x0, mp_int_t x1, mp_int_t hx0, mp_int_t hx1, const mp_int_t *clip, int n_clip, mp_int_t col) {
+    mp_int_t seg[4];
+    int n_seg = 0;
+    if (hx0 > hx1) {
+        seg[n_seg++] = x0;
+        seg[n_seg++] = x1;
+    } else {
+        if (x0 < hx0) {
+            seg[n_seg++] = x0;
+            seg[n_seg++] = MIN(x1, hx0 - 1);
+        }
+        if (hx1 < x1) {
+            seg[n_seg++] = MAX(x0, hx1 + 1);
+            seg[n_seg++] = x1;
+        }
+    }
+    for (int i = 0; i < n_seg; i += 2) {
+        for (int j = 0; j < n_clip * 2; j += 2) {
+            mp_int_t a = MAX(seg[i], clip[j]);
+            mp_int_t b = MIN(seg[i + 1], clip[j + 1]);
+            if (a <= b) {
+                fill_rect(fb, cx + a, y, b - a + 1, 1, col);
+            }
+        }
+    }
+}
+
+// Fills the ring between the ellipse (xr, yr) and the one inset by width
+// (the whole ellipse if width is 0), row by row under the clip. Every row
+// is written once, as a single span where the clip allows.
+STATIC void ellipse_ring(const mp_obj_framebuf_t *fb, mp_int_t cx, mp_int_t cy, mp_int_t xr, mp_int_t yr, mp_int_t width, const curve_clip_t *clip, mp_int_t col) {
+    if (xr < 0 || yr < 0) {
+        return;
+    }
+    mp_int_t outer_buf[ELLIPSE_EXTENT_STACK];
+    mp_int_t inner_buf[ELLIPSE_EXTENT_STACK];
+    mp_int_t *outer = ellipse_extents(xr, yr, outer_buf);
+    mp_int_t ixr = xr - width;
+    mp_int_t iyr = yr - width;
+    mp_int_t *inner = NULL;
+    if (width > 0 && ixr >= 0 && iyr >= 0) {
+        inner = ellipse_extents(ixr, iyr, inner_buf);
+    }
+    mp_int_t dy_end = MIN(yr, fb->height - 1 - cy);
+    for (mp_int_t dy = MAX(-yr, -cy); dy <= dy_end; dy++) {
+        mp_int_t ady = dy < 0 ? -dy : dy;
+        mp_int_t hole = (inner && ady <= iyr) ? inner[ady] : -1;
+        mp_int_t clip_x[4];
+        int n_clip = curve_clip_row(clip, dy, clip_x);
+        fill_row_clipped(fb, cx, cy + dy, -outer[ady], outer[ady], -hole, hole, clip_x, n_clip, col);
+    }
+    if (inner) {
+        ellipse_extents_free(inner, iyr, inner_buf);
+    }
+    ellipse_extents_free(outer, yr, outer_buf);
+}
+
+// Ellipse of the quadrants in mask, filled if it has ELLIPSE_MASK_FILL,
+// otherwise an outline of the given width.
+STATIC void draw_ellipse(const mp_obj_framebuf_t *fb, int cx, int cy, int xr, int yr, uint32_t col, int mask, int width) {
+    curve_clip_t clip = { .mask = mask & ELLIPSE_MASK_ALL, .wedge = false };
+    if (mask & ELLIPSE_MASK_FILL) {
+        // One span per row, or one per half when only some quadrants are set.
+        ellipse_ring(fb, cx, cy, xr, yr, 0, &clip, col);
+        return;
+    }
+    if (width > 1) {
+        // Thick outline: a ring of the given width drawn as spans.
+        ellipse_ring(fb, cx, cy, xr, yr, width, &clip, col);
+        return;
+    }
+    ellipse_ctx_t ctx = { .fb = fb, .cx = cx, .cy = cy, .col = col, .mask = mask };
+    ellipse_midpoint(xr, yr, ellipse_draw_point, &ctx);
+}
+
+STATIC mp_obj_t framebuf_ellipse(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args_in[0]));
+    mp_int_t args[5];
+    framebuf_args(args_in, args, 5); // cx, cy, xradius, yradius, col
+    mp_int_t mask = (n_args > 6 && mp_obj_is_true(args_in[6])) ? ELLIPSE_MASK_FILL : 0;
+    if (n_args > 7) {
+        mask |= mp_obj_get_int(args_in[7]) & ELLIPSE_MASK_ALL;
+    } else {
+        mask |= ELLIPSE_MASK_ALL;
+    }
+    draw_ellipse(self, args[0], args[1], args[2], args[3], args[4], mask, n_args > 8 ? mp_obj_get_int(args_in[8]) : 1);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_ellipse_obj, 6, 9, framebuf_ellipse);
+
+STATIC mp_obj_t framebuf_arc(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args_in[0]));
+    mp_int_t args[7];
+    framebuf_args(args_in, args, 7); // cx, cy, xradius, yradius, start, end, col
+    mp_int_t width = 1;
+    if (n_args > 8) {
+        width = MAX(1, mp_obj_get_int(args_in[8]));
+    }
+    curve_clip_t clip;
+    if (curve_clip_angles(&clip, args[4], args[5])) {
+        ellipse_ring(self, args[0], args[1], args[2], args[3], width, &clip, args[6]);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_arc_obj, 8, 9, framebuf_arc);
+
+STATIC mp_obj_t framebuf_pie(size_t n_args, const mp_obj_t *args_in) {
+    (void)n_args;
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args_in[0]));
+    mp_int_t args[7];
+    framebuf_args(args_in, args, 7); // cx, cy, xradius, yradius, start, end, col
+    curve_clip_t clip;
+    if (curve_clip_angles(&clip, args[4], args[5])) {
+        ellipse_ring(self, args[0], args[1], args[2], args[3], 0, &clip, args[6]);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_pie_obj, 8, 8, framebuf_pie);
+
+// Span of a rounded rectangle on a given row; extent holds the corner
+// circle's half-widths from ellipse_extents().
+STATIC void round_rect_span(mp_int_t x, mp_int_t y, mp_int_t w, mp_int_t h, mp_int_t r, const mp_int_t *extent, mp_int_t row, mp_int_t *x0, mp_int_t *x1) {
+    mp_int_t d = 0;
+    if (row < y + r) {
+        d = y + r - row;
+    } else if (row > y + h - 1 - r) {
+        d = row - (y + h - 1 - r);
+    }
+    mp_int_t inset = r - extent[d];
+    *x0 = x + inset;
+    *x1 = x + w - 1 - inset;
+}
+
+STATIC mp_obj_t framebuf_round_rect(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args_in[0]));
+    mp_int_t args[6];
+    framebuf_args(args_in, args, 6); // x, y, w, h, radius, col
+    mp_int_t x = args[0], y = args[1], w = args[2], h = args[3];
+    mp_int_t stroke = 1;
+    if (n_args > 7 && mp_obj_is_true(args_in[7])) {
+        stroke = 0;
+    } else if (n_args > 8) {
+        stroke = MAX(1, mp_obj_get_int(args_in[8]));
+    }
+    if (w < 1 || h < 1) {
+        return mp_const_none;
+    }
+    // The two corner circles of a side must not overlap.
+    mp_int_t r = MAX(0, MIN(args[4], (MIN(w, h) - 1) / 2));
+    mp_int_t outer_buf[ELLIPSE_EXTENT_STACK];
+    mp_int_t inner_buf[ELLIPSE_EXTENT_STACK];
+    mp_int_t *outer = ellipse_extents(r, r, outer_buf);
+
+    // The inner rounded rectangle that an outline leaves empty.
+    mp_int_t ix = x + stroke, iy = y + stroke;
+    mp_int_t iw = w - 2 * stroke, ih = h - 2 * stroke;
+    mp_int_t ir = MAX(0, MIN(r - stroke, (MIN(iw, ih) - 1) / 2));
+    mp_int_t *inner = NULL;
+    if (stroke && iw > 0 && ih > 0) {
+        inner = ellipse_extents(ir, ir, inner_buf);
+    }
+
+    const mp_int_t no_clip[2] = { -CURVE_INF, CURVE_INF };
+    mp_int_t row_end = MIN(y + h, self->height);
+    for (mp_int_t row = MAX(y, 0); row < row_end; row++) {
+        mp_int_t x0, x1, hx0 = 1, hx1 = 0;
+        round_rect_span(x, y, w, h, r, outer, row, &x0, &x1);
+        if (inner && iy <= row && row < iy + ih) {
+            round_rect_span(ix, iy, iw, ih, ir, inner, row, &hx0, &hx1);
+        }
+        fill_row_clipped(self, 0, row, x0, x1, hx0, hx1, no_clip, 1, args[5]);
+    }
+    if (inner) {
+        ellipse_extents_free(inner, ir, inner_buf);
+    }
+    ellipse_extents_free(outer, r, outer_buf);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_round_rect_obj, 7, 9, framebuf_round_rect);
+
+#if MICROPY_PY_ARRAY && !MICROPY_ENABLE_DYNRUNTIME
+// TODO: poly needs mp_binary_get_size & mp_binary_get_val_array which aren't
+// available in dynruntime.h yet.
+
+STATIC mp_int_t poly_int(mp_buffer_info_t *bufinfo, size_t index) {
+    return mp_obj_get_int(mp_binary_get_val_array(bufinfo->typecode, bufinfo->buf, index));
+}
+
+// Builds the edges of the closed polygon in bufinfo, offset by (x, y).
+STATIC void poly_load_edges(poly_edge_t *edges, mp_buffer_info_t *bufinfo, int n_poly, mp_int_t x, mp_int_t y, int poly) {
+    mp_int_t px1 = x + poly_int(bufinfo, n_poly * 2 - 2);
+    mp_int_t py1 = y + poly_int(bufinfo, n_poly * 2 - 1);
+    for (int i = 0; i < n_poly; i++) {
+        mp_int_t px2 = x + poly_int(bufinfo, i * 2);
+        mp_int_t py2 = y + poly_int(bufinfo, i * 2 + 1);
+        poly_set_edge(&edges[i], px1, py1, px2, py2, poly);
+        px1 = px2;
+        py1 = py2;
+    }
+}
+
+STATIC mp_obj_t framebuf_poly(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args_in[0]));
+
+    mp_int_t x = mp_obj_get_int(args_in[1]);
+    mp_int_t y = mp_obj_get_int(args_in[2]);
+
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args_in[3], &bufinfo, MP_BUFFER_READ);
+    // If an odd number of values was given, this rounds down to multiple of two.
+    int n_poly = bufinfo.len / (mp_binary_get_size('@', bufinfo.typecode, NULL) * 2);
+
+    if (n_poly == 0) {
+        return mp_const_none;
+    }
+
+    mp_int_t col = mp_obj_get_int(args_in[4]);
+    bool fill = n_args > 5 && mp_obj_is_true(args_in[5]);
+
+    if (fill) {
+        mp_int_t rule = POLY_EVEN_ODD;
+        if (n_args > 6) {
+            rule = poly_rule(args_in[6]);
+        }
+        poly_edge_t *edges = m_new(poly_edge_t, n_poly);
+        poly_load_edges(edges, &bufinfo, n_poly, x, y, 0);
+        poly_fill(self, edges, n_poly, &col, rule);
+        m_del(poly_edge_t, edges, n_poly);
+    } else {
+        // Outline only.
+        mp_int_t px1 = poly_int(&bufinfo, 0);
+        mp_int_t py1 = poly_int(&bufinfo, 1);
+        int i = n_poly * 2 - 1;
+        do {
+            mp_int_t py2 = poly_int(&bufinfo, i--);
+            mp_int_t px2 = poly_int(&bufinfo, i--);
+            line(self, x + px1, y + py1, x + px2, y + py2, col);
+            px1 = px2;
+            py1 = py2;
+        } while (i >= 0);
+    }
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_poly_obj, 5, 7, framebuf_poly);
+
+STATIC mp_obj_t framebuf_polys(size_t n_args, const mp_obj_t *args_in) {
+    // polys(x, y, polys, cols[, rule]): fill a list of vertex arrays in one
+    // scanline sweep. cols is one colour per polygon, or a single colour.
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args_in[0]));
+
+    mp_int_t x = mp_obj_get_int(args_in[1]);
+    mp_int_t y = mp_obj_get_int(args_in[2]);
+
+    size_t n_polys;
+    mp_obj_t *polys;
+    mp_obj_get_array(args_in[3], &n_polys, &polys);
+    if (n_polys == 0) {
+        return mp_const_none;
+    }
+
+    size_t n_cols = 0;
+    mp_obj_t *cols_in = NULL;
+    if (mp_obj_is_int(args_in[4])) {
+        n_cols = 1;
+    } else {
+        mp_obj_get_array(args_in[4], &n_cols, &cols_in);
+        if (n_cols != n_polys) {
+            mp_raise_ValueError(MP_ERROR_TEXT("need one colour per polygon"));
+        }
+    }
+    mp_int_t rule = POLY_EVEN_ODD;
+    if (n_args > 5) {
+        rule = poly_rule(args_in[5]);
+    }
+
+    // Size the shared edge table.
+    int n_edges = 0;
+    for (size_t i = 0; i < n_polys; i++) {
+        mp_buffer_info_t bufinfo;
+        mp_get_buffer_raise(polys[i], &bufinfo, MP_BUFFER_READ);
+        n_edges += bufinfo.len / (mp_binary_get_size('@', bufinfo.typecode, NULL) * 2);
+    }
+    if (n_edges == 0) {
+        return mp_const_none;
+    }
+
+    mp_int_t *cols = m_new(mp_int_t, n_polys);
+    poly_edge_t *edges = m_new(poly_edge_t, n_edges);
+    int n_loaded = 0;
+    for (size_t i = 0; i < n_polys; i++) {
+        cols[i] = mp_obj_get_int(cols_in ? cols_in[i] : args_in[4]);
+        mp_buffer_info_t bufinfo;
+        mp_get_buffer_raise(polys[i], &bufinfo, MP_BUFFER_READ);
+        int n_poly = bufinfo.len / (mp_binary_get_size('@', bufinfo.typecode, NULL) * 2);
+        if (n_poly) {
+            poly_load_edges(&edges[n_loaded], &bufinfo, n_poly, x, y, i);
+            n_loaded += n_poly;
+        }
+    }
+    poly_fill(self, edges, n_edges, cols, rule);
+    m_del(poly_edge_t, edges, n_edges);
+    m_del(mp_int_t, cols, n_polys);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_polys_obj, 5, 6, framebuf_polys);
+#endif // MICROPY_PY_ARRAY && !MICROPY_ENABLE_DYNRUNTIME
+
+// Combines n source bytes into the target, a word at a time when both
+// pointers share the same alignment. The ranges may overlap, as they do
+// when a buffer is blitted onto itself.
+STATIC void rop_copy_bytes(uint8_t *d, const uint8_t *s, size_t n, int rop) {
+    if (rop == FRAMEBUF_ROP_COPY) {
+        memmove(d, s, n);
+        return;
+    }
+    if (d > s && d < s + n) {
+        // Walk backwards so no source byte is overwritten before it's read.
+        d += n;
+        s += n;
+        if (((uintptr_t)d & 3) == ((uintptr_t)s & 3)) {
+            for (; n && ((uintptr_t)d & 3); --n) {
+                --d, --s;
+                *d = rop_apply(*d, *s, rop);
+            }
+            for (; n >= 4; n -= 4) {
+                d -= 4, s -= 4;
+                *(uint32_t *)d = rop_apply(*(uint32_t *)d, *(const uint32_t *)s, rop);
+            }
+        }
+        while (n--) {
+            --d, --s;
+            *d = rop_apply(*d, *s, rop);
+        }
+        return;
+    }
+    if (((uintptr_t)d & 3) == ((uintptr_t)s & 3)) {
+        for (; n && ((uintptr_t)d & 3); --n, ++d, ++s) {
+            *d = rop_apply(*d, *s, rop);
+        }
+        for (; n >= 4; n -= 4, d += 4, s += 4) {
+            *(uint32_t *)d = rop_apply(*(uint32_t *)d, *(const uint32_t *)s, rop);
+        }
+    }
+    for (; n; --n, ++d, ++s) {
+        *d = rop_apply(*d, *s, rop);
+    }
+}
+
+// blit() between two unrotated buffers of the same format, on whole bytes
+// with masks only at the edges of packed formats. The source must sit at
+// the same bit position within a byte as the target; returns false otherwise.
+STATIC bool blit_same_format(const mp_obj_framebuf_t *self, const mp_obj_framebuf_t *source, int x0, int y0, int x1, int y1, int w, int h, int rop) {
+    if (self->format != source->format || (self->format & (FRAMEBUF_MX | FRAMEBUF_MY | FRAMEBUF_MV)) != 0 || source->band_h
+        || self->tile || source->tile) {
+        return false;
+    }
+    int yend = y0 + h;
+    y1 += band_clip(self, &y0, &yend);
+    if (y0 >= yend) {
+        return true;
+    }
+    h = yend - y0;
+    y0 = band_row(self, y0);
+    // A buffer blitted onto itself further down or right is walked bottom-up
+    // and right to left, so no source byte is overwritten before it's read.
+    bool back = self->buf == source->buf && (y0 > y1 || (y0 == y1 && x0 > x1));
+    if ((self->format & 0xE0) == (FRAMEBUF_RGB565 & 0xE0) || self->format == FRAMEBUF_RGB332 || self->format == FRAMEBUF_RGB666) {
+        static const uint8_t pixel_bytes[4] = { 2, 2, 3, 4 };
+        int n = self->format == FRAMEBUF_RGB332 ? 1 : pixel_bytes[self->format & 0x03];
+        int dy = 1;
+        if (back) {
+            y0 += h - 1;
+            y1 += h - 1;
+            dy = -1;
+        }
+        for (; h; --h, y0 += dy, y1 += dy) {
+            rop_copy_bytes(&((uint8_t *)self->buf)[(x0 + y0 * self->stride) * n],
+                &((const uint8_t *)source->buf)[(x1 + y1 * source->stride) * n], w * n, rop);
+        }
+        return true;
+    }
+    int bpp;
+    bool vertical = (self->format & 0x02) == 0;
+    switch (self->format & 0xE0) {
+        case FRAMEBUF_MON_VLSB & 0xE0:
+            bpp = 1;
+            break;
+        case FRAMEBUF_GS2_HMSB & 0xE0:
+            bpp = 2;
+            break;
+        case FRAMEBUF_GS4_HMSB & 0xE0:
+            bpp = 4;
+            break;
+        case FRAMEBUF_GS8_H & 0xE0:
+            if (!vertical) {
+                // GS8_H keeps columns contiguous.
+                return false;
+            }
+            bpp = 8;
+            vertical = false;
+            break;
+        default:
+            return false;
+    }
+    int ppb = 8 / bpp;
+    bool msb = (self->format & 0x01) != 0;
+    uint8_t *dbuf = (uint8_t *)self->buf;
+    const uint8_t *sbuf = (const uint8_t *)source->buf;
+    if (vertical) {
+        if (y0 % ppb != y1 % ppb) {
+            return false;
+        }
+        int dy = y1 - y0;
+        yend = y0 + h;
+        while (y0 < yend) {
+            // The next band, from the top or from the bottom.
+            int band = (back ? yend - 1 : y0) / ppb;
+            int band_y = MAX(y0, band * ppb);
+            int band_end = MIN(yend, (band + 1) * ppb);
+            if (back) {
+                yend = band_y;
+            } else {
+                y0 = band_end;
+            }
+            uint8_t mask = packed_mask(band_y - band * ppb, band_end - band * ppb, bpp, msb);
+            uint8_t *d = &dbuf[band * self->stride + x0];
+            const uint8_t *s = &sbuf[((band_y + dy) / ppb) * source->stride + x1];
+            if (mask == 0xff) {
+                rop_copy_bytes(d, s, w, rop);
+            } else if (back) {
+                for (int ww = w; ww--;) {
+                    rop_byte(&d[ww], mask, s[ww], rop);
+                }
+            } else {
+                for (int ww = w; ww; --ww) {
+                    rop_byte(d++, mask, *s++, rop);
+                }
+            }
+        }
+    } else {
+        if (x0 % ppb != x1 % ppb) {
+            return false;
+        }
+        int dy = 1;
+        if (back) {
+            y0 += h - 1;
+            y1 += h - 1;
+            dy = -1;
+        }
+        for (; h; --h, y0 += dy, y1 += dy) {
+            fb_index_t p = y0 * self->stride + x0;
+            fb_index_t pend = p + w;
+            uint8_t *d = &dbuf[p / ppb];
+            const uint8_t *s = &sbuf[(y1 * source->stride + x1) / ppb];
+            // A partial first byte, n whole bytes, then a partial last byte.
+            fb_index_t e = p % ppb ? MIN(pend, (p / ppb + 1) * ppb) : p;
+            int lead = e > p;
+            int n = (pend - e) / ppb;
+            fb_index_t tail = e + n * ppb;
+            if (back && tail < pend) {
+                rop_byte(&d[lead + n], packed_mask(0, pend - tail, bpp, msb), s[lead + n], rop);
+            }
+            if (!back && lead) {
+                rop_byte(d, packed_mask(p % ppb, e - p / ppb * ppb, bpp, msb), *s, rop);
+            }
+            if (n > 0) {
+                rop_copy_bytes(&d[lead], &s[lead], n, rop);
+            }
+            if (back && lead) {
+                rop_byte(d, packed_mask(p % ppb, e - p / ppb * ppb, bpp, msb), *s, rop);
+            }
+            if (!back && tail < pend) {
+                rop_byte(&d[lead + n], packed_mask(0, pend - tail, bpp, msb), s[lead + n], rop);
+            }
+        }
+    }
+    return true;
+}
+
+// Whether a format holds RGB colours.
+static inline bool rgb_format(uint8_t format) {
+    return (format & 0xE0) == (FRAMEBUF_RGB565 & 0xE0) || (format & 0xE0) == (FRAMEBUF_RGB332 & 0xE0);
+}
+
+// Defined with the conversion engine below.
+STATIC uint8_t value_kind(uint8_t format);
+STATIC uint32_t fb_pixel_to_argb(const mp_obj_framebuf_t *fb, uint32_t v);
+STATIC uint32_t fb_argb_to_pixel(const mp_obj_framebuf_t *fb, uint32_t argb);
+
+// Whether source values are drawn into self through 0xAARRGGBB: a PAL
+// source into a buffer without a palette, or RGB332/444/666 pixels into
+// another RGB format or the other way round. RGB565, RGB888 and RGB8888
+// copy raw values between themselves as they always have.
+static inline bool blit_converts(const mp_obj_framebuf_t *self, const mp_obj_framebuf_t *source) {
+    if (source->palette) {
+        return !self->palette;
+    }
+    return rgb_format(source->format) && rgb_format(self->format)
+           && value_kind(source->format) != value_kind(self->format)
+           && ((source->format & 0xE0) == (FRAMEBUF_RGB332 & 0xE0) || (self->format & 0xE0) == (FRAMEBUF_RGB332 & 0xE0));
+}
+
+// Draws source with its top left corner at x, y; key, palette and rop as
+// for blit().
+STATIC void draw_blit(const mp_obj_framebuf_t *self, const mp_obj_framebuf_t *source, mp_int_t x, mp_int_t y, mp_int_t key, const mp_obj_framebuf_t *palette, int rop) {
+    if (
+        (x >= self->width) ||
+        (y >= self->height) ||
+        (-x >= source->width) ||
+        (-y >= source->height)
+        ) {
+        // Out of bounds, no-op.
+        return;
+    }
+
+    // Clip.
+    int x0 = MAX(0, x);
+    int y0 = MAX(0, y);
+    int x1 = MAX(0, -x);
+    int y1 = MAX(0, -y);
+    int x0end = MIN(self->width, x + source->width);
+    int y0end = MIN(self->height, y + source->height);
+    y1 += band_clip(self, &y0, &y0end);
+
+    if (key == -1 && !palette && blit_same_format(self, source, x0, y0, x1, y1, x0end - x0, y0end - y0, rop)) {
+        return;
+    }
+
+    // A PAL source drawn into a buffer without a palette is resolved through
+    // its own palette, worked out once in the target's values.
+    bool converts = !palette && blit_converts(self, source);
+    bool resolve = converts && source->palette;
+    uint32_t lut[resolve ? 1 << pal_bits(source->format) : 1];
+    if (resolve) {
+        for (int i = 0; i < 1 << pal_bits(source->format); i++) {
+            lut[i] = fb_argb_to_pixel(self, 0xff000000 | source->palette[i]);
+        }
+    }
+
+    for (; y0 < y0end; ++y0) {
+        int cx1 = x1;
+        for (int cx0 = x0; cx0 < x0end; ++cx0) {
+            uint32_t col = getpixel(source, cx1, y1);
+            if (palette) {
+                col = getpixel(palette, col, 0);
+            } else if (resolve) {
+                col = lut[col];
+            } else if (converts) {
+                col = fb_argb_to_pixel(self, fb_pixel_to_argb(source, col));
+            }
+            if (col != (uint32_t)key) {
+                setpixel_rop(self, cx0, y0, col, rop);
+            }
+            ++cx1;
+        }
+        ++y1;
+    }
+}
+
+STATIC mp_obj_t framebuf_blit(size_t n_args, const mp_obj_t *args) {
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args[0]));
+    mp_obj_t source_in = mp_obj_cast_to_native_base(args[1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (source_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *source = MP_OBJ_TO_PTR(source_in);
+
+    mp_int_t x = mp_obj_get_int(args[2]);
+    mp_int_t y = mp_obj_get_int(args[3]);
+    mp_int_t key = -1;
+    if (n_args > 4) {
+        key = mp_obj_get_int(args[4]);
+    }
+    mp_obj_framebuf_t *palette = NULL;
+    if (n_args > 5 && args[5] != mp_const_none) {
+        palette = MP_OBJ_TO_PTR(mp_obj_cast_to_native_base(args[5], MP_OBJ_FROM_PTR(&mp_type_framebuf)));
+    }
+    mp_int_t rop = FRAMEBUF_ROP_COPY;
+    if (n_args > 6) {
+        rop = mp_obj_get_int(args[6]);
+    }
+    draw_blit(self, source, x, y, key, palette, rop);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_blit_obj, 4, 7, framebuf_blit);
+
+// Colour of an RGB format pixel as 0xAARRGGBB. Only RGB8888 carries an
+// alpha, in its top byte; the other formats are opaque. Short fields are
+// widened by repeating their top bits.
+STATIC uint32_t rgb_to_argb(uint8_t format, uint32_t col) {
+    switch (format & 0xE3) {
+        case FRAMEBUF_RGB565:
+        case FRAMEBUF_RGB565SW: {
+            uint32_t r = (col >> 11) & 0x1f, g = (col >> 5) & 0x3f, b = col & 0x1f;
+            return 0xff000000 | ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+        }
+        case FRAMEBUF_RGB888:
+            return 0xff000000 | (col & 0xffffff);
+        case FRAMEBUF_RGB332: {
+            uint32_t r = (col >> 5) & 0x07, g = (col >> 2) & 0x07, b = col & 0x03;
+            return 0xff000000 | ((r << 5 | r << 2 | r >> 1) << 16) | ((g << 5 | g << 2 | g >> 1) << 8) | b * 0x55;
+        }
+        case FRAMEBUF_RGB444:
+            return 0xff000000 | (((col >> 8) & 0x0f) * 0x110000) | (((col >> 4) & 0x0f) * 0x1100) | ((col & 0x0f) * 0x11);
+        case FRAMEBUF_RGB666:
+            col &= 0xfcfcfc;
+            return 0xff000000 | col | ((col >> 6) & 0x030303);
+        default:
+            return col;
+    }
+}
+
+STATIC uint32_t argb_to_rgb(uint8_t format, uint32_t argb) {
+    switch (format & 0xE3) {
+        case FRAMEBUF_RGB565:
+        case FRAMEBUF_RGB565SW:
+            return ((argb >> 8) & 0xf800) | ((argb >> 5) & 0x07e0) | ((argb >> 3) & 0x001f);
+        case FRAMEBUF_RGB888:
+            return argb & 0xffffff;
+        case FRAMEBUF_RGB332:
+            return ((argb >> 16) & 0xe0) | ((argb >> 11) & 0x1c) | ((argb >> 6) & 0x03);
+        case FRAMEBUF_RGB444:
+            return ((argb >> 12) & 0xf00) | ((argb >> 8) & 0x0f0) | ((argb >> 4) & 0x00f);
+        case FRAMEBUF_RGB666:
+            return argb & 0xfcfcfc;
+        default:
+            return argb;
+    }
+}
+
+// a * b / 255, rounded, for a and b in 0..255.
+static inline uint32_t mul_div255(uint32_t a, uint32_t b) {
+    uint32_t t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+// Blends two RGB565 colours with alpha 0..255, rounded. The green field is moved to
+// the top half of a word so that all three channels share one multiply.
+static inline uint32_t blend_rgb565(uint32_t fg, uint32_t bg, uint32_t a) {
+    a = (a + 4) >> 3;
+    fg = (fg | (fg << 16)) & 0x07e0f81f;
+    bg = (bg | (bg << 16)) & 0x07e0f81f;
+    uint32_t r = (bg + (((fg - bg) * a + 0x02008010) >> 5)) & 0x07e0f81f;
+    return (r | (r >> 16)) & 0xffff;
+}
+
+// Blends two 0xAARRGGBB colours with alpha 0..255, two channels per multiply.
+static inline uint32_t blend_argb(uint32_t fg, uint32_t bg, uint32_t a) {
+    a += a >> 7;
+    uint32_t rb = (((fg & 0x00ff00ff) * a + (bg & 0x00ff00ff) * (256 - a) + 0x00800080) >> 8) & 0x00ff00ff;
+    uint32_t ag = (((fg >> 8) & 0x00ff00ff) * a + ((bg >> 8) & 0x00ff00ff) * (256 - a) + 0x00800080) & 0xff00ff00;
+    return rb | ag;
+}
+
+STATIC mp_obj_t framebuf_blit_blend(size_t n_args, const mp_obj_t *args) {
+    // blit_blend(fbuf, x, y[, alpha[, mask]]): draw an RGB source over an RGB
+    // buffer. The alpha of each pixel is the product of the source's own
+    // (RGB8888 only), the GS4/GS8 mask at the same source position, and
+    // the constant alpha.
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args[0]));
+    mp_obj_t source_in = mp_obj_cast_to_native_base(args[1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (source_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *source = MP_OBJ_TO_PTR(source_in);
+
+    mp_int_t x = mp_obj_get_int(args[2]);
+    mp_int_t y = mp_obj_get_int(args[3]);
+    mp_int_t alpha = 255;
+    if (n_args > 4) {
+        alpha = MAX(0, MIN(255, mp_obj_get_int(args[4])));
+    }
+    mp_obj_framebuf_t *mask = NULL;
+    if (n_args > 5 && args[5] != mp_const_none) {
+        mp_obj_t mask_in = mp_obj_cast_to_native_base(args[5], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+        if (mask_in == MP_OBJ_NULL) {
+            mp_raise_TypeError(NULL);
+        }
+        mask = MP_OBJ_TO_PTR(mask_in);
+        if ((mask->format & 0xE0) != (FRAMEBUF_GS4_HMSB & 0xE0) && (mask->format & 0xE0) != (FRAMEBUF_GS8_H & 0xE0)) {
+            mp_raise_ValueError(MP_ERROR_TEXT("mask must be GS4 or GS8"));
+        }
+    }
+    if (!rgb_format(self->format) || !rgb_format(source->format)) {
+        mp_raise_ValueError(MP_ERROR_TEXT("blend needs RGB buffers"));
+    }
+
+    if (
+        alpha == 0 ||
+        (x >= self->width) ||
+        (y >= self->height) ||
+        (-x >= source->width) ||
+        (-y >= source->height)
+        ) {
+        // Out of bounds or transparent, no-op.
+        return mp_const_none;
+    }
+
+    // Clip.
+    int x0 = MAX(0, x);
+    int y0 = MAX(0, y);
+    int x1 = MAX(0, -x);
+    int y1 = MAX(0, -y);
+    int x0end = MIN(self->width, x + source->width);
+    int y0end = MIN(self->height, y + source->height);
+    bool rgb565 = (self->format & 0xE2) == FRAMEBUF_RGB565;
+    bool mask_gs4 = mask && (mask->format & 0xE0) == (FRAMEBUF_GS4_HMSB & 0xE0);
+
+    for (; y0 < y0end; ++y0) {
+        int cx1 = x1;
+        for (int cx0 = x0; cx0 < x0end; ++cx0, ++cx1) {
+            uint32_t argb = rgb_to_argb(source->format, getpixel(source, cx1, y1));
+            uint32_t a = argb >> 24;
+            if (mask) {
+                uint32_t m = getpixel(mask, cx1, y1);
+                a = mul_div255(a, mask_gs4 ? m * 17 : m);
+            }
+            if (alpha != 255) {
+                a = mul_div255(a, alpha);
+            }
+            if (a == 0) {
+                continue;
+            }
+            uint32_t col;
+            if (a == 255) {
+                col = argb_to_rgb(self->format, argb);
+            } else if (rgb565) {
+                col = blend_rgb565(argb_to_rgb(self->format, argb), getpixel(self, cx0, y0), a);
+            } else {
+                col = argb_to_rgb(self->format, blend_argb(argb | 0xff000000, rgb_to_argb(self->format, getpixel(self, cx0, y0)), a));
+            }
+            setpixel(self, cx0, y0, col);
+        }
+        ++y1;
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_blit_blend_obj, 4, 6, framebuf_blit_blend);
+
+STATIC mp_obj_t framebuf_blit_mask(size_t n_args, const mp_obj_t *args) {
+    // blit_mask(mono_fb, x, y, fg[, bg]): draw the set bits of a mono buffer
+    // in fg and the clear bits in bg, or leave them alone if bg is None.
+    // Runs of equal bits are written as spans.
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args[0]));
+    mp_obj_t source_in = mp_obj_cast_to_native_base(args[1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (source_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *source = MP_OBJ_TO_PTR(source_in);
+    if ((source->format & 0xE0) != (FRAMEBUF_MON_VLSB & 0xE0)) {
+        mp_raise_ValueError(MP_ERROR_TEXT("mask must be mono"));
+    }
+
+    mp_int_t x = mp_obj_get_int(args[2]);
+    mp_int_t y = mp_obj_get_int(args[3]);
+    // col[0] is only drawn with a bg, but keep it defined.
+    mp_int_t col[2] = { 0, mp_obj_get_int(args[4]) };
+    bool has_bg = n_args > 5 && args[5] != mp_const_none;
+    if (has_bg) {
+        col[0] = mp_obj_get_int(args[5]);
+    }
+
+    // Clip in source coordinates.
+    int sx0 = MAX(0, -x);
+    int sy0 = MAX(0, -y);
+    int sx1 = MIN(source->width, self->width - x);
+    int sy1 = MIN(source->height, self->height - y);
+    if (sx0 >= sx1 || sy0 >= sy1) {
+        return mp_const_none;
+    }
+
+    // Unrotated, unbanded, untiled buffers are read straight from memory, a
+    // byte at a time for horizontal ones as in text(); others go through
+    // getpixel().
+    bool direct = (source->format & (FRAMEBUF_MX | FRAMEBUF_MY | FRAMEBUF_MV)) == 0 && !source->band_h && !source->tile;
+    bool horizontal = (source->format & 0x02) != 0;
+    bool msb = (source->format & 0x01) != 0;
+    const uint8_t *buf = (const uint8_t *)source->buf;
+
+    for (int sy = sy0; sy < sy1; ++sy) {
+        const uint8_t *b = NULL;
+        uint8_t mask = 0;
+        if (direct && horizontal) {
+            b = &buf[(sx0 + sy * source->stride) >> 3];
+            mask = msb ? 0x80 >> (sx0 & 0x07) : 0x01 << (sx0 & 0x07);
+        } else if (direct) {
+            b = &buf[sx0 + (sy >> 3) * source->stride];
+            mask = msb ? 0x80 >> (sy & 0x07) : 0x01 << (sy & 0x07);
+        }
+        int run = sx0;
+        int run_on = 0;
+        for (int sx = sx0; sx < sx1; ++sx) {
+            int on;
+            if (!direct) {
+                on = getpixel(source, sx, sy) != 0;
+            } else if (horizontal) {
+                on = (*b & mask) != 0;
+                mask = msb ? mask >> 1 : mask << 1;
+                if (mask == 0) {
+                    ++b;
+                    mask = msb ? 0x80 : 0x01;
+                }
+            } else {
+                on = (*b++ & mask) != 0;
+            }
+            if (sx == sx0) {
+                run_on = on;
+            } else if (on != run_on) {
+                if (run_on || has_bg) {
+                    fill_rect(self, x + run, y + sy, sx - run, 1, col[run_on]);
+                }
+                run = sx;
+                run_on = on;
+            }
+        }
+        if (run_on || has_bg) {
+            fill_rect(self, x + run, y + sy, sx1 - run, 1, col[run_on]);
+        }
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_blit_mask_obj, 5, 6, framebuf_blit_mask);
+
+// Colour of source value col in self as blit() draws it: through the
+// palette, or through the colours of a PAL or differing RGB source.
+static inline uint32_t blit_colour(const mp_obj_framebuf_t *self, const mp_obj_framebuf_t *source, const mp_obj_framebuf_t *palette, uint32_t col) {
+    if (palette) {
+        return getpixel(palette, col, 0);
+    }
+    if (blit_converts(self, source)) {
+        return fb_argb_to_pixel(self, fb_pixel_to_argb(source, col));
+    }
+    return col;
+}
+
+// Writes source pixel (sx, sy) to (x, y) as blit() does: through the
+// palette, skipping the key colour.
+static inline void blit_pixel(const mp_obj_framebuf_t *self, int x, int y, const mp_obj_framebuf_t *source, int sx, int sy, mp_int_t key, const mp_obj_framebuf_t *palette) {
+    uint32_t col = blit_colour(self, source, palette, getpixel(source, sx, sy));
+    if (col != (uint32_t)key) {
+        setpixel(self, x, y, col);
+    }
+}
+
+// Average of four source pixels, as a value of the source format.
+STATIC uint32_t box_average(const mp_obj_framebuf_t *source, const uint32_t *p) {
+    switch (source->format & 0xE0) {
+        case FRAMEBUF_RGB565 & 0xE0:
+        case FRAMEBUF_RGB332 & 0xE0: {
+            uint32_t rb = 0, ag = 0;
+            for (int i = 0; i < 4; i++) {
+                uint32_t argb = rgb_to_argb(source->format, p[i]);
+                rb += argb & 0x00ff00ff;
+                ag += (argb >> 8) & 0x00ff00ff;
+            }
+            rb = ((rb + 0x00020002) >> 2) & 0x00ff00ff;
+            ag = ((ag + 0x00020002) >> 2) & 0x00ff00ff;
+            return argb_to_rgb(source->format, rb | (ag << 8));
+        }
+        case FRAMEBUF_MON_VLSB & 0xE0:
+        case FRAMEBUF_ST7302 & 0xE0:
+            return p[0] + p[1] + p[2] + p[3] >= 2;
+        case FRAMEBUF_PAL2 & 0xE0:
+            // Indices can't be averaged.
+            return p[0];
+        default:
+            return (p[0] + p[1] + p[2] + p[3] + 2) >> 2;
+    }
+}
+
+// Average of the 2x2 source pixels from (sx, sy), as a colour of the target
+// as blit_colour() gives it. Blocks touching the key colour, which is
+// compared after the palette or conversion as in blit(), are not blended.
+STATIC uint32_t box_filter(const mp_obj_framebuf_t *self, const mp_obj_framebuf_t *source, int sx, int sy, mp_int_t key, const mp_obj_framebuf_t *palette) {
+    int sx1 = MIN(sx + 1, source->width - 1);
+    int sy1 = MIN(sy + 1, source->height - 1);
+    uint32_t p[4] = {
+        getpixel(source, sx, sy), getpixel(source, sx1, sy),
+        getpixel(source, sx, sy1), getpixel(source, sx1, sy1),
+    };
+    uint32_t first = blit_colour(self, source, palette, p[0]);
+    for (int i = 1; i < 4; i++) {
+        if (first == (uint32_t)key || blit_colour(self, source, palette, p[i]) == (uint32_t)key) {
+            return first;
+        }
+    }
+    return blit_colour(self, source, palette, box_average(source, p));
+}
+
+// Nearest-neighbour DDA: source index q of target pixel i is
+// (2 * i + 1) * src / (2 * dst), i.e. the source pixel under the target
+// pixel's centre, stepped with a remainder instead of a division.
+typedef struct _scale_dda_t {
+    mp_int_t q, r, dq, dr, den;
+} scale_dda_t;
+
+STATIC void scale_dda_init(scale_dda_t *d, mp_int_t src, mp_int_t dst, mp_int_t i) {
+    uint64_t n = (uint64_t)(2 * i + 1) * src;
+    d->den = 2 * dst;
+    d->q = n / d->den;
+    d->r = n % d->den;
+    d->dq = 2 * src / d->den;
+    d->dr = 2 * src % d->den;
+}
+
+// Left/top pixel of the 2x2 block around the sample, for box_filter().
+static inline mp_int_t scale_dda_box(const scale_dda_t *d) {
+    return MAX(0, d->q - (2 * d->r < d->den));
+}
+
+static inline void scale_dda_step(scale_dda_t *d) {
+    d->q += d->dq;
+    d->r += d->dr;
+    if (d->r >= d->den) {
+        d->q += 1;
+        d->r -= d->den;
+    }
+}
+
+STATIC mp_obj_t framebuf_blit_scaled(size_t n_args, const mp_obj_t *args) {
+    // blit_scaled(fbuf, x, y, w, h[, key[, palette[, filter]]]): draw the
+    // source stretched to w x h, nearest neighbour. filter averages 2x2
+    // source blocks when shrinking.
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args[0]));
+    mp_obj_t source_in = mp_obj_cast_to_native_base(args[1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (source_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *source = MP_OBJ_TO_PTR(source_in);
+
+    mp_int_t x = mp_obj_get_int(args[2]);
+    mp_int_t y = mp_obj_get_int(args[3]);
+    mp_int_t w = mp_obj_get_int(args[4]);
+    mp_int_t h = mp_obj_get_int(args[5]);
+    mp_int_t key = -1;
+    if (n_args > 6) {
+        key = mp_obj_get_int(args[6]);
+    }
+    mp_obj_framebuf_t *palette = NULL;
+    if (n_args > 7 && args[7] != mp_const_none) {
+        palette = MP_OBJ_TO_PTR(mp_obj_cast_to_native_base(args[7], MP_OBJ_FROM_PTR(&mp_type_framebuf)));
+    }
+    bool box = n_args > 8 && mp_obj_is_true(args[8]) && (w < source->width || h < source->height);
+
+    // Clip.
+    int x0 = MAX(0, x);
+    int y0 = MAX(0, y);
+    int x0end = MIN(self->width, x + w);
+    int y0end = MIN(self->height, y + h);
+    if (w < 1 || h < 1 || source->width < 1 || source->height < 1 || x0 >= x0end || y0 >= y0end) {
+        return mp_const_none;
+    }
+
+    // Source column of every visible target column, worked out once. The
+    // filter reads the 2x2 block that the target pixel's centre falls in.
+    int n = x0end - x0;
+    fb_size_t sx_buf[64];
+    fb_size_t *sx = n <= 64 ? sx_buf : m_new(fb_size_t, n);
+    scale_dda_t dda;
+    scale_dda_init(&dda, source->width, w, x0 - x);
+    for (int i = 0; i < n; i++, scale_dda_step(&dda)) {
+        sx[i] = box ? scale_dda_box(&dda) : dda.q;
+    }
+
+    scale_dda_init(&dda, source->height, h, y0 - y);
+    for (; y0 < y0end; ++y0, scale_dda_step(&dda)) {
+        int sy = box ? scale_dda_box(&dda) : dda.q;
+        for (int i = 0; i < n; i++) {
+            if (box) {
+                uint32_t col = box_filter(self, source, sx[i], sy, key, palette);
+                if (col != (uint32_t)key) {
+                    setpixel(self, x0 + i, y0, col);
+                }
+            } else {
+                blit_pixel(self, x0 + i, y0, source, sx[i], sy, key, palette);
+            }
+        }
+    }
+    if (sx != sx_buf) {
+        m_del(fb_size_t, sx, n);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_blit_scaled_obj, 6, 9, framebuf_blit_scaled);
+
+STATIC mp_obj_t framebuf_blit_rotated(size_t n_args, const mp_obj_t *args) {
+    // blit_rotated(fbuf, cx, cy, angle[, key[, palette]]): draw the source
+    // turned clockwise by angle degrees about its centre, placed at (cx, cy).
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args[0]));
+    mp_obj_t source_in = mp_obj_cast_to_native_base(args[1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (source_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *source = MP_OBJ_TO_PTR(source_in);
+
+    mp_int_t cx = mp_obj_get_int(args[2]);
+    mp_int_t cy = mp_obj_get_int(args[3]);
+    mp_int_t angle = mp_obj_get_int(args[4]) % 360;
+    if (angle < 0) {
+        angle += 360;
+    }
+    mp_int_t key = -1;
+    if (n_args > 5) {
+        key = mp_obj_get_int(args[5]);
+    }
+    mp_obj_framebuf_t *palette = NULL;
+    if (n_args > 6 && args[6] != mp_const_none) {
+        palette = MP_OBJ_TO_PTR(mp_obj_cast_to_native_base(args[6], MP_OBJ_FROM_PTR(&mp_type_framebuf)));
+    }
+    int sw = source->width;
+    int sh = source->height;
+
+    if (angle % 90 == 0) {
+        // Exact quarter turns: every target pixel maps to one source pixel.
+        int w = angle % 180 ? sh : sw;
+        int h = angle % 180 ? sw : sh;
+        int x = cx - w / 2;
+        int y = cy - h / 2;
+        int y0end = MIN(self->height, y + h);
+        int x0end = MIN(self->width, x + w);
+        for (int y0 = MAX(0, y); y0 < y0end; ++y0) {
+            for (int x0 = MAX(0, x); x0 < x0end; ++x0) {
+                int dx = x0 - x, dy = y0 - y;
+                switch (angle) {
+                    case 0:
+                        blit_pixel(self, x0, y0, source, dx, dy, key, palette);
+                        break;
+                    case 90:
+                        blit_pixel(self, x0, y0, source, dy, sh - 1 - dx, key, palette);
+                        break;
+                    case 180:
+                        blit_pixel(self, x0, y0, source, sw - 1 - dx, sh - 1 - dy, key, palette);
+                        break;
+                    default:
+                        blit_pixel(self, x0, y0, source, sw - 1 - dy, dx, key, palette);
+                        break;
+                }
+            }
+        }
+        return mp_const_none;
+    }
+
+    // Any other angle maps each target pixel back into the source, in Q14.
+    // Along a row the source position moves by a constant step.
+    mp_int_t c, s;
+    angle_to_vector(angle, &c, &s);
+    mp_int_t half_w = ((c < 0 ? -c : c) * sw + (s < 0 ? -s : s) * sh) >> 15;
+    mp_int_t half_h = ((s < 0 ? -s : s) * sw + (c < 0 ? -c : c) * sh) >> 15;
+    int x0 = MAX(0, cx - half_w - 1);
+    int y0 = MAX(0, cy - half_h - 1);
+    int x0end = MIN(self->width, cx + half_w + 2);
+    int y0end = MIN(self->height, cy + half_h + 2);
+    mp_int_t u_max = (mp_int_t)sw << 14;
+    mp_int_t v_max = (mp_int_t)sh << 14;
+    for (; y0 < y0end; ++y0) {
+        mp_int_t dx = x0 - cx, dy = y0 - cy;
+        mp_int_t u = c * dx + s * dy + (u_max >> 1);
+        mp_int_t v = -s * dx + c * dy + (v_max >> 1);
+        for (int xx = x0; xx < x0end; ++xx, u += c, v -= s) {
+            if (0 <= u && u < u_max && 0 <= v && v < v_max) {
+                blit_pixel(self, xx, y0, source, u >> 14, v >> 14, key, palette);
+            }
+        }
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_blit_rotated_obj, 5, 7, framebuf_blit_rotated);
+
+STATIC mp_obj_t framebuf_tilemap(size_t n_args, const mp_obj_t *args) {
+    // tilemap(tileset, tile_w, tile_h, indices, x, y, cols, rows[, key]):
+    // draw a cols x rows grid of tiles. Tiles are numbered left to right,
+    // top to bottom in the tileset; indices outside it leave the cell alone.
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args[0]));
+    mp_obj_t source_in = mp_obj_cast_to_native_base(args[1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (source_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *source = MP_OBJ_TO_PTR(source_in);
+    mp_int_t tile_w = mp_obj_get_int(args[2]);
+    mp_int_t tile_h = mp_obj_get_int(args[3]);
+    mp_buffer_info_t indices;
+    mp_get_buffer_raise(args[4], &indices, MP_BUFFER_READ);
+    mp_int_t x = mp_obj_get_int(args[5]);
+    mp_int_t y = mp_obj_get_int(args[6]);
+    mp_int_t cols = mp_obj_get_int(args[7]);
+    mp_int_t rows = mp_obj_get_int(args[8]);
+    mp_int_t key = -1;
+    if (n_args > 9) {
+        key = mp_obj_get_int(args[9]);
+    }
+    int index_size;
+    if ((indices.typecode == BYTEARRAY_TYPECODE) || (indices.typecode == 'B') || (indices.typecode == 'b')) {
+        index_size = 1;
+    } else if ((indices.typecode == 'H') || (indices.typecode == 'h')) {
+        index_size = 2;
+    } else {
+        mp_raise_ValueError(MP_ERROR_TEXT("indices must be B b H h"));
+    }
+    if (cols < 1 || rows < 1) {
+        return mp_const_none;
+    }
+    if (tile_w < 1 || tile_h < 1 || (size_t)(cols * rows) > indices.len / index_size) {
+        mp_raise_ValueError(MP_ERROR_TEXT("not enough indices"));
+    }
+    mp_int_t per_row = source->width / tile_w;
+    mp_int_t n_tiles = per_row * (source->height / tile_h);
+
+    // Only the rows and columns of tiles that reach the buffer.
+    mp_int_t r0 = MAX(0, -y / tile_h);
+    mp_int_t r1 = MIN(rows, (self->height - y + tile_h - 1) / tile_h);
+    mp_int_t c0 = MAX(0, -x / tile_w);
+    mp_int_t c1 = MIN(cols, (self->width - x + tile_w - 1) / tile_w);
+    for (mp_int_t r = r0; r < r1; r++) {
+        // Vertical clipping is the same for the whole row of tiles.
+        int ty = y + r * tile_h;
+        int y0 = MAX(0, ty);
+        int y0end = MIN(self->height, ty + tile_h);
+        if (y0 >= y0end) {
+            continue;
+        }
+        for (mp_int_t c = c0; c < c1; c++) {
+            size_t i = r * cols + c;
+            mp_int_t t;
+            switch (indices.typecode) {
+                case 'b':
+                    t = ((int8_t *)indices.buf)[i];
+                    break;
+                case 'h':
+                    t = ((int16_t *)indices.buf)[i];
+                    break;
+                case 'H':
+                    t = ((uint16_t *)indices.buf)[i];
+                    break;
+                default:
+                    t = ((uint8_t *)indices.buf)[i];
+                    break;
+            }
+            if (t < 0 || t >= n_tiles) {
+                continue;
+            }
+            int tx = x + c * tile_w;
+            int x0 = MAX(0, tx);
+            int x0end = MIN(self->width, tx + tile_w);
+            if (x0 >= x0end) {
+                continue;
+            }
+            int sx = (t % per_row) * tile_w + (x0 - tx);
+            int sy = (t / per_row) * tile_h + (y0 - ty);
+            if (key == -1 && blit_same_format(self, source, x0, y0, sx, sy, x0end - x0, y0end - y0, FRAMEBUF_ROP_COPY)) {
+                continue;
+            }
+            for (int yy = y0; yy < y0end; ++yy) {
+                for (int xx = x0; xx < x0end; ++xx) {
+                    blit_pixel(self, xx, yy, source, sx + xx - x0, sy + yy - y0, key, NULL);
+                }
+            }
+        }
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_tilemap_obj, 9, 10, framebuf_tilemap);
+
+#if MICROPY_PY_ARRAY && !MICROPY_ENABLE_DYNRUNTIME
+// A blit_many() record after clipping: target rectangle and source corner.
+typedef struct _sprite_t {
+    int x, y, w, h;
+    int sx, sy;
+} sprite_t;
+
+STATIC mp_obj_t framebuf_blit_many(size_t n_args, const mp_obj_t *args) {
+    // blit_many(fbuf, records[, key[, palette]]): blit many rectangles of
+    // one source. records is an array of (x, y, src_x, src_y, w, h) groups.
+    // Later records draw over earlier ones, as with separate blit() calls.
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args[0]));
+    mp_obj_t source_in = mp_obj_cast_to_native_base(args[1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (source_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *source = MP_OBJ_TO_PTR(source_in);
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[2], &bufinfo, MP_BUFFER_READ);
+    size_t n_records = bufinfo.len / (mp_binary_get_size('@', bufinfo.typecode, NULL) * 6);
+    mp_int_t key = -1;
+    if (n_args > 3) {
+        key = mp_obj_get_int(args[3]);
+    }
+    mp_obj_framebuf_t *palette = NULL;
+    if (n_args > 4 && args[4] != mp_const_none) {
+        palette = MP_OBJ_TO_PTR(mp_obj_cast_to_native_base(args[4], MP_OBJ_FROM_PTR(&mp_type_framebuf)));
+    }
+    bool same_format = key == -1 && !palette;
+
+    // Clip every record once against both buffers.
+    sprite_t *sprites = m_new(sprite_t, n_records);
+    size_t n = 0;
+    for (size_t i = 0; i < n_records; i++) {
+        mp_int_t x = poly_int(&bufinfo, i * 6);
+        mp_int_t y = poly_int(&bufinfo, i * 6 + 1);
+        mp_int_t sx = poly_int(&bufinfo, i * 6 + 2);
+        mp_int_t sy = poly_int(&bufinfo, i * 6 + 3);
+        mp_int_t w = poly_int(&bufinfo, i * 6 + 4);
+        mp_int_t h = poly_int(&bufinfo, i * 6 + 5);
+        // Skip what lies off either buffer.
+        mp_int_t dx = MAX(MAX(0, -x), -sx);
+        mp_int_t dy = MAX(MAX(0, -y), -sy);
+        w = MIN(MIN(w, self->width - x), source->width - sx) - dx;
+        h = MIN(MIN(h, self->height - y), source->height - sy) - dy;
+        if (w > 0 && h > 0) {
+            sprite_t *sp = &sprites[n++];
+            sp->x = x + dx;
+            sp->y = y + dy;
+            sp->w = w;
+            sp->h = h;
+            sp->sx = sx + dx;
+            sp->sy = sy + dy;
+        }
+    }
+
+    // Walk the target top to bottom. order holds the records by first row
+    // (stable, so equal rows keep their order); active holds the records
+    // crossing the current row in record order, which keeps the overdraw
+    // of separate blits.
+    size_t *order = m_new(size_t, n * 2);
+    size_t *active = order + n;
+    int row_end = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t j = i;
+        for (; j > 0 && sprites[order[j - 1]].y > sprites[i].y; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+        row_end = MAX(row_end, sprites[i].y + sprites[i].h);
+    }
+    size_t next = 0;
+    size_t n_active = 0;
+    for (int row = n ? sprites[order[0]].y : 0; row < row_end; row++) {
+        for (; next < n && sprites[order[next]].y == row; next++) {
+            size_t j = n_active++;
+            for (; j > 0 && active[j - 1] > order[next]; j--) {
+                active[j] = active[j - 1];
+            }
+            active[j] = order[next];
+        }
+        if (n_active == 0) {
+            // Nothing until the next record starts.
+            if (next < n) {
+                row = sprites[order[next]].y - 1;
+            }
+            continue;
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < n_active; i++) {
+            const sprite_t *sp = &sprites[active[i]];
+            int sy = sp->sy + row - sp->y;
+            if (!same_format || !blit_same_format(self, source, sp->x, row, sp->sx, sy, sp->w, 1, FRAMEBUF_ROP_COPY)) {
+                for (int k = 0; k < sp->w; k++) {
+                    blit_pixel(self, sp->x + k, row, source, sp->sx + k, sy, key, palette);
+                }
+            }
+            if (row + 1 < sp->y + sp->h) {
+                active[kept++] = active[i];
+            }
+        }
+        n_active = kept;
+    }
+    m_del(size_t, order, n * 2);
+    m_del(sprite_t, sprites, n_records);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_blit_many_obj, 3, 5, framebuf_blit_many);
+#endif // MICROPY_PY_ARRAY && !MICROPY_ENABLE_DYNRUNTIME
+
+// Conversion engine. A row of pixel values is read from the source by a
+// per-format row kernel, mapped, and written by the target's row kernel.
+// Values are mapped through a palette, kept as they are between formats of
+// the same kind, or otherwise converted through 0xAARRGGBB.
+
+// Pixels per pass of the conversion engine.
+#define CONVERT_CHUNK (64)
+
+// Colour of a pixel value as 0xAARRGGBB; mono 1 is white.
+STATIC uint32_t pixel_to_argb(uint8_t format, uint32_t v) {
+    switch (format & 0xE0) {
+        case FRAMEBUF_GS2_HMSB & 0xE0:
+            return 0xff000000 | (v & 0x03) * 0x555555;
+        case FRAMEBUF_GS4_HMSB & 0xE0:
+            return 0xff000000 | (v & 0x0f) * 0x111111;
+        case FRAMEBUF_GS8_H & 0xE0:
+            return 0xff000000 | (v & 0xff) * 0x010101;
+        case FRAMEBUF_RGB565 & 0xE0:
+        case FRAMEBUF_RGB332 & 0xE0:
+            return rgb_to_argb(format, v);
+        case FRAMEBUF_PAL2 & 0xE0: {
+            // The default grey ramp, for PAL values without a buffer.
+            uint32_t mask = (1 << pal_bits(format)) - 1;
+            return 0xff000000 | (v & mask) * 255 / mask * 0x010101;
+        }
+        default:
+            return v ? 0xffffffff : 0xff000000;
+    }
+}
+
+STATIC uint32_t argb_to_grey(uint32_t argb) {
+    return (((argb >> 16) & 0xff) * 77 + ((argb >> 8) & 0xff) * 150 + (argb & 0xff) * 29) >> 8;
+}
+
+// Pixel value closest to a colour; grey formats take its luminance.
+STATIC uint32_t argb_to_pixel(uint8_t format, uint32_t argb) {
+    if (rgb_format(format)) {
+        return argb_to_rgb(format, argb);
+    }
+    uint32_t lum = argb_to_grey(argb);
+    switch (format & 0xE0) {
+        case FRAMEBUF_GS2_HMSB & 0xE0:
+            return lum >> 6;
+        case FRAMEBUF_GS4_HMSB & 0xE0:
+            return lum >> 4;
+        case FRAMEBUF_GS8_H & 0xE0:
+            return lum;
+        case FRAMEBUF_PAL2 & 0xE0:
+            return lum >> (8 - pal_bits(format));
+        default:
+            return lum >= 0x80;
+    }
+}
+
+// Colour of a pixel value of a buffer, through its palette if it has one.
+STATIC uint32_t fb_pixel_to_argb(const mp_obj_framebuf_t *fb, uint32_t v) {
+    if (fb->palette) {
+        return 0xff000000 | fb->palette[v & ((1 << pal_bits(fb->format)) - 1)];
+    }
+    return pixel_to_argb(fb->format, v);
+}
+
+// Pixel value of a buffer closest to a colour. PAL buffers search their
+// palette for the nearest entry, so filling them from colours is slow.
+STATIC uint32_t fb_argb_to_pixel(const mp_obj_framebuf_t *fb, uint32_t argb) {
+    if (!fb->palette) {
+        return argb_to_pixel(fb->format, argb);
+    }
+    int r = (argb >> 16) & 0xff, g = (argb >> 8) & 0xff, b = argb & 0xff;
+    uint32_t best = 0, best_d = UINT32_MAX;
+    for (int i = 0; i < 1 << pal_bits(fb->format); i++) {
+        uint32_t c = fb->palette[i];
+        int dr = (int)((c >> 16) & 0xff) - r, dg = (int)((c >> 8) & 0xff) - g, db = (int)(c & 0xff) - b;
+        uint32_t d = dr * dr + dg * dg + db * db;
+        if (d < best_d) {
+            best = i;
+            best_d = d;
+            if (d == 0) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+// Dither stage for grey and mono targets. Bayer patterns need no state;
+// Floyd-Steinberg keeps the error of one row, so rows can be fed one at a
+// time from a stream.
+typedef struct _dither_t {
+    uint8_t mode;
+    uint8_t bits;           // bits of the target grey level
+    int width;
+    int16_t *err;           // error for the next row in 1/16ths, from x = -1
+    int16_t right, below, below_right;
+} dither_t;
+
+STATIC const uint8_t bayer8[64] = {
+    0, 32, 8, 40, 2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44, 4, 36, 14, 46, 6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+    3, 35, 11, 43, 1, 33, 9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47, 7, 39, 13, 45, 5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21,
+};
+
+// Bits of grey a format keeps, or 0 if it holds colours.
+STATIC int grey_bits(uint8_t format) {
+    switch (format & 0xE0) {
+        case FRAMEBUF_MON_VLSB & 0xE0:
+        case FRAMEBUF_ST7302 & 0xE0:
+            return 1;
+        case FRAMEBUF_GS2_HMSB & 0xE0:
+            return 2;
+        case FRAMEBUF_GS4_HMSB & 0xE0:
+            return 4;
+        case FRAMEBUF_GS8_H & 0xE0:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+STATIC mp_int_t dither_arg(mp_obj_t arg) {
+    mp_int_t mode = mp_obj_get_int(arg);
+    if (mode < FRAMEBUF_DITHER_NONE || mode > FRAMEBUF_DITHER_FS) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid dither"));
+    }
+    return mode;
+}
+
+// Sets up dithering of rows of width pixels into format.
+STATIC void dither_init(dither_t *d, mp_int_t mode, uint8_t format, int width) {
+    d->bits = grey_bits(format);
+    d->mode = d->bits == 0 || d->bits == 8 ? FRAMEBUF_DITHER_NONE : mode;
+    d->width = MAX(width, 0);
+    d->err = NULL;
+    d->right = d->below = d->below_right = 0;
+    if (d->mode == FRAMEBUF_DITHER_FS) {
+        d->err = m_new0(int16_t, d->width + 2);
+    }
+}
+
+STATIC void dither_deinit(dither_t *d) {
+    if (d->err) {
+        m_del(int16_t, d->err, d->width + 2);
+    }
+}
+
+// Starts a row; each row must be fed from x = 0 up.
+STATIC void dither_row(dither_t *d) {
+    if (d->err) {
+        d->err[d->width] = d->below;
+    }
+    d->right = d->below = d->below_right = 0;
+}
+
+// Reduces grey level g (0-255) at (x, y) to the target's bits.
+STATIC uint32_t dither_grey(dither_t *d, int x, int y, int g) {
+    int levels = (1 << d->bits) - 1;
+    switch (d->mode) {
+        case FRAMEBUF_DITHER_BAYER4:
+            return (g * levels + (bayer8[(y & 3) * 8 + (x & 3)] + 2) * 255 / 64) / 255;
+        case FRAMEBUF_DITHER_BAYER8:
+            return (g * levels + (bayer8[(y & 7) * 8 + (x & 7)] * 2 + 1) * 255 / 128) / 255;
+        case FRAMEBUF_DITHER_FS: {
+            int v = MAX(0, MIN(255, g + ((d->err[x + 1] + d->right + 8) >> 4)));
+            int q = (v * levels + 127) / 255;
+            int e = v - q * 255 / levels;
+            // 7/16 right, 3/16 below left, 5/16 below, 1/16 below right
+            d->err[x] = d->below + 3 * e;
+            d->below = d->below_right + 5 * e;
+            d->below_right = e;
+            d->right = 7 * e;
+            return q;
+        }
+        default:
+            return d->bits == 1 ? g >= 0x80 : (uint32_t)g >> (8 - d->bits);
+    }
+}
+
+// Bits per pixel of a packed format stored along rows, or 0.
+STATIC int packed_row_bpp(uint8_t format) {
+    if ((format & 0x02) == 0) {
+        return 0;
+    }
+    switch (format & 0xE0) {
+        case FRAMEBUF_MON_VLSB & 0xE0:
+            return 1;
+        case FRAMEBUF_GS2_HMSB & 0xE0:
+            return 2;
+        case FRAMEBUF_GS4_HMSB & 0xE0:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+// Reads n pixel values of row y from x. Unrotated RGB, GS8_V and horizontal
+// packed buffers are read straight from memory.
+STATIC void convert_read_row(const mp_obj_framebuf_t *fb, int x, int y, int n, uint32_t *vals) {
+    int row = band_row(fb, y);
+    if ((fb->format & (FRAMEBUF_MX | FRAMEBUF_MY | FRAMEBUF_MV)) == 0 && row >= 0 && !fb->tile) {
+        size_t index = x + row * fb->stride;
+        int bpp = packed_row_bpp(fb->format);
+        if ((fb->format & 0xE0) == (FRAMEBUF_RGB565 & 0xE0)) {
+            switch (fb->format & 0x03) {
+                case 0: {
+                    const uint16_t *p = &((const uint16_t *)fb->buf)[index];
+                    for (int i = 0; i < n; i++) {
+                        vals[i] = p[i];
+                    }
+                    return;
+                }
+                case 1: {
+                    const uint8_t *p = &((const uint8_t *)fb->buf)[index * 2];
+                    for (int i = 0; i < n; i++, p += 2) {
+                        vals[i] = p[0] << 8 | p[1];
+                    }
+                    return;
+                }
+                case 2: {
+                    const uint8_t *p = &((const uint8_t *)fb->buf)[index * 3];
+                    for (int i = 0; i < n; i++, p += 3) {
+                        vals[i] = p[0] << 16 | p[1] << 8 | p[2];
+                    }
+                    return;
+                }
+                default: {
+                    const uint32_t *p = &((const uint32_t *)fb->buf)[index];
+                    for (int i = 0; i < n; i++) {
+                        vals[i] = p[i];
+                    }
+                    return;
+                }
+            }
+        } else if (fb->format == FRAMEBUF_GS8_V) {
+            const uint8_t *p = &((const uint8_t *)fb->buf)[index];
+            for (int i = 0; i < n; i++) {
+                vals[i] = p[i];
+            }
+            return;
+        } else if (bpp) {
+            int ppb = 8 / bpp;
+            bool msb = (fb->format & 0x01) != 0;
+            const uint8_t *buf = (const uint8_t *)fb->buf;
+            for (int i = 0; i < n; i++, index++) {
+                int slot = index % ppb;
+                vals[i] = (buf[index / ppb] >> ((msb ? ppb - 1 - slot : slot) * bpp)) & ((1 << bpp) - 1);
+            }
+            return;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        vals[i] = getpixel(fb, x + i, y);
+    }
+}
+
+// Writes n pixel values to row y from x, the counterpart of
+// convert_read_row(). Packed bytes are written once they are complete.
+STATIC void convert_write_row(const mp_obj_framebuf_t *fb, int x, int y, int n, const uint32_t *vals) {
+    int row = band_row(fb, y);
+    if ((fb->format & (FRAMEBUF_MX | FRAMEBUF_MY | FRAMEBUF_MV)) == 0 && row >= 0 && !fb->tile) {
+        size_t index = x + row * fb->stride;
+        int bpp = packed_row_bpp(fb->format);
+        if ((fb->format & 0xE0) == (FRAMEBUF_RGB565 & 0xE0)) {
+            switch (fb->format & 0x03) {
+                case 0: {
+                    uint16_t *p = &((uint16_t *)fb->buf)[index];
+                    for (int i = 0; i < n; i++) {
+                        p[i] = vals[i];
+                    }
+                    return;
+                }
+                case 1: {
+                    uint8_t *p = &((uint8_t *)fb->buf)[index * 2];
+                    for (int i = 0; i < n; i++) {
+                        *p++ = (vals[i] >> 8) & 0xff;
+                        *p++ = vals[i] & 0xff;
+                    }
+                    return;
+                }
+                case 2: {
+                    uint8_t *p = &((uint8_t *)fb->buf)[index * 3];
+                    for (int i = 0; i < n; i++) {
+                        *p++ = (vals[i] >> 16) & 0xff;
+                        *p++ = (vals[i] >> 8) & 0xff;
+                        *p++ = vals[i] & 0xff;
+                    }
+                    return;
+                }
+                default: {
+                    uint32_t *p = &((uint32_t *)fb->buf)[index];
+                    for (int i = 0; i < n; i++) {
+                        p[i] = vals[i];
+                    }
+                    return;
+                }
+            }
+        } else if (fb->format == FRAMEBUF_GS8_V) {
+            uint8_t *p = &((uint8_t *)fb->buf)[index];
+            for (int i = 0; i < n; i++) {
+                p[i] = vals[i];
+            }
+            return;
+        } else if (bpp) {
+            int ppb = 8 / bpp;
+            bool msb = (fb->format & 0x01) != 0;
+            uint8_t pix = (1 << bpp) - 1;
+            uint8_t *buf = (uint8_t *)fb->buf;
+            uint8_t acc = 0, mask = 0;
+            for (int i = 0; i < n; i++, index++) {
+                int slot = index % ppb;
+                int shift = (msb ? ppb - 1 - slot : slot) * bpp;
+                uint32_t v = bpp == 1 ? vals[i] != 0 : vals[i];
+                acc |= (v & pix) << shift;
+                mask |= pix << shift;
+                if (slot == ppb - 1 || i == n - 1) {
+                    uint8_t *b = &buf[index / ppb];
+                    *b = (*b & ~mask) | acc;
+                    acc = 0;
+                    mask = 0;
+                }
+            }
+            return;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        setpixel(fb, x + i, y, vals[i]);
+    }
+}
+
+// Formats of the same kind use the same pixel values, whatever their layout.
+STATIC uint8_t value_kind(uint8_t format) {
+    switch (format & 0xE0) {
+        case FRAMEBUF_ST7302 & 0xE0:
+            return FRAMEBUF_MON_VLSB;
+        case FRAMEBUF_RGB565 & 0xE0:
+            // RGB565 and RGB565SW only differ in byte order.
+            return (format & 0x02) == 0 ? FRAMEBUF_RGB565 : format & 0xE3;
+        case FRAMEBUF_RGB332 & 0xE0:
+        case FRAMEBUF_PAL2 & 0xE0:
+            return format & 0xE3;
+        default:
+            return format & 0xE0;
+    }
+}
+
+// How pixel values are mapped between the two buffers.
+typedef struct _convert_map_t {
+    const mp_obj_framebuf_t *palette;
+    bool has_matrix;
+    mp_int_t matrix[12];    // rows of r, g, b weights in Q8, then an offset
+    mp_int_t dither;        // for colours reduced to grey or mono
+} convert_map_t;
+
+// Reads the optional palette FrameBuffer or colour matrix argument.
+STATIC void convert_map_arg(convert_map_t *map, size_t n_args, const mp_obj_t *args, size_t i) {
+    map->palette = NULL;
+    map->has_matrix = false;
+    map->dither = FRAMEBUF_DITHER_NONE;
+    if (n_args > i + 1) {
+        map->dither = dither_arg(args[i + 1]);
+    }
+    if (n_args <= i || args[i] == mp_const_none) {
+        return;
+    }
+    mp_obj_t palette_in = mp_obj_cast_to_native_base(args[i], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (palette_in != MP_OBJ_NULL) {
+        map->palette = MP_OBJ_TO_PTR(palette_in);
+        return;
+    }
+    size_t len;
+    mp_obj_t *items;
+    mp_obj_get_array(args[i], &len, &items);
+    if (len != 9 && len != 12) {
+        mp_raise_ValueError(MP_ERROR_TEXT("matrix needs 9 or 12 values"));
+    }
+    // 9 values are the weights alone, with no offsets.
+    for (size_t k = 0; k < 12; k++) {
+        size_t row = k / 4, col = k % 4;
+        if (len == 12) {
+            map->matrix[k] = mp_obj_get_int(items[k]);
+        } else {
+            map->matrix[k] = col < 3 ? mp_obj_get_int(items[row * 3 + col]) : 0;
+        }
+    }
+    map->has_matrix = true;
+}
+
+STATIC uint32_t convert_matrix(const mp_int_t *m, uint32_t argb) {
+    mp_int_t r = (argb >> 16) & 0xff, g = (argb >> 8) & 0xff, b = argb & 0xff;
+    uint32_t out = argb & 0xff000000;
+    for (int k = 0; k < 3; k++, m += 4) {
+        mp_int_t c = ((m[0] * r + m[1] * g + m[2] * b + 128) >> 8) + m[3];
+        out |= MAX(0, MIN(255, c)) << (16 - 8 * k);
+    }
+    return out;
+}
+
+// 8x8 blocks of 1-bit buffers. A block is held in a uint64_t with row i in
+// byte i and the leftmost pixel of each row in bit 0, so whole blocks can be
+// turned with a few shifts and masks instead of 64 pixel calls.
+
+// Swaps rows and columns of a block.
+static inline uint64_t block_transpose(uint64_t b) {
+    uint64_t t;
+    t = (b ^ (b >> 7)) & 0x00aa00aa00aa00aaULL;
+    b ^= t ^ (t << 7);
+    t = (b ^ (b >> 14)) & 0x0000cccc0000ccccULL;
+    b ^= t ^ (t << 14);
+    t = (b ^ (b >> 28)) & 0x00000000f0f0f0f0ULL;
+    b ^= t ^ (t << 28);
+    return b;
+}
+
+// Mirrors every row of a block.
+static inline uint64_t block_mirror_x(uint64_t b) {
+    b = ((b >> 1) & 0x5555555555555555ULL) | ((b & 0x5555555555555555ULL) << 1);
+    b = ((b >> 2) & 0x3333333333333333ULL) | ((b & 0x3333333333333333ULL) << 2);
+    return ((b >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((b & 0x0f0f0f0f0f0f0f0fULL) << 4);
+}
+
+// Reverses the order of the rows of a block.
+static inline uint64_t block_mirror_y(uint64_t b) {
+    b = ((b >> 8) & 0x00ff00ff00ff00ffULL) | ((b & 0x00ff00ff00ff00ffULL) << 8);
+    b = ((b >> 16) & 0x0000ffff0000ffffULL) | ((b & 0x0000ffff0000ffffULL) << 16);
+    return (b >> 32) | (b << 32);
+}
+
+// Where the block at (x, y) lies in memory. MX and MY mirror it within the
+// buffer, MV swaps its coordinates and, for mono formats, the byte layout.
+// Returns false when the block does not start on byte boundaries, or the
+// buffer is tiled.
+STATIC bool mono_block_origin(const mp_obj_framebuf_t *fb, int x, int y, int *mx, int *my, bool *horizontal) {
+    if (fb->tile) {
+        return false;
+    }
+    if ((fb->format & FRAMEBUF_MX) != 0) {
+        x = fb->width - 8 - x;
+    }
+    if ((fb->format & FRAMEBUF_MY) != 0) {
+        y = fb->height - 8 - y;
+    }
+    if (fb->band_h) {
+        // Banded buffers have no MY or MV, so the block must lie in the band.
+        y -= fb->band_y;
+        if (y + 8 > fb->band_h) {
+            return false;
+        }
+    }
+    if (x < 0 || y < 0) {
+        return false;
+    }
+    bool mv = (fb->format & FRAMEBUF_MV) != 0;
+    *mx = mv ? y : x;
+    *my = mv ? x : y;
+    if ((fb->format & 0xE0) == (FRAMEBUF_ST7302 & 0xE0)) {
+        *horizontal = false;
+        return (*mx & 3) == 0 && (*my & 1) == 0 && (fb->stride & 3) == 0;
+    }
+    *horizontal = ((fb->format & 0x02) != 0) != mv;
+    if (*horizontal) {
+        return (*mx & 7) == 0 && (fb->stride & 7) == 0;
+    }
+    return (*my & 7) == 0;
+}
+
+// Reads the block at (x, y) as it appears on screen.
+STATIC bool mono_block_load(const mp_obj_framebuf_t *fb, int x, int y, uint64_t *block) {
+    int mx, my;
+    bool horizontal;
+    if (!mono_block_origin(fb, x, y, &mx, &my, &horizontal)) {
+        return false;
+    }
+    const uint8_t *buf = (const uint8_t *)fb->buf;
+    uint64_t b = 0;
+    if ((fb->format & 0xE0) == (FRAMEBUF_ST7302 & 0xE0)) {
+        // Each byte holds 4 columns of 2 rows, from bit 7 down.
+        for (int band = 0; band < 4; band++) {
+            const uint8_t *p = &buf[(((my >> 1) + band) * fb->stride + mx) >> 2];
+            for (int bit = 0; bit < 16; bit++) {
+                int col = bit >> 1, row = (band << 1) + (bit & 1);
+                int v = (p[col >> 2] >> (7 - (((col & 3) << 1) + (bit & 1)))) & 1;
+                b |= (uint64_t)v << ((row << 3) + col);
+            }
+        }
+    } else if (horizontal) {
+        for (int i = 0; i < 8; i++) {
+            b |= (uint64_t)buf[(mx + (my + i) * fb->stride) >> 3] << (i << 3);
+        }
+    } else {
+        // Column bytes, which give the block turned on its side.
+        for (int i = 0; i < 8; i++) {
+            b |= (uint64_t)buf[mx + i + (my >> 3) * fb->stride] << (i << 3);
+        }
+    }
+    if ((fb->format & 0xE0) != (FRAMEBUF_ST7302 & 0xE0)) {
+        if ((fb->format & 0x01) != 0) {
+            b = block_mirror_x(b);
+        }
+        if (!horizontal) {
+            b = block_transpose(b);
+        }
+    }
+    if ((fb->format & FRAMEBUF_MV) != 0) {
+        b = block_transpose(b);
+    }
+    if ((fb->format & FRAMEBUF_MX) != 0) {
+        b = block_mirror_x(b);
+    }
+    if ((fb->format & FRAMEBUF_MY) != 0) {
+        b = block_mirror_y(b);
+    }
+    *block = b;
+    return true;
+}
+
+// Writes a block to (x, y), the counterpart of mono_block_load().
+STATIC bool mono_block_store(const mp_obj_framebuf_t *fb, int x, int y, uint64_t b) {
+    int mx, my;
+    bool horizontal;
+    if (!mono_block_origin(fb, x, y, &mx, &my, &horizontal)) {
+        return false;
+    }
+    if ((fb->format & FRAMEBUF_MY) != 0) {
+        b = block_mirror_y(b);
+    }
+    if ((fb->format & FRAMEBUF_MX) != 0) {
+        b = block_mirror_x(b);
+    }
+    if ((fb->format & FRAMEBUF_MV) != 0) {
+        b = block_transpose(b);
+    }
+    uint8_t *buf = (uint8_t *)fb->buf;
+    if ((fb->format & 0xE0) == (FRAMEBUF_ST7302 & 0xE0)) {
+        for (int band = 0; band < 4; band++) {
+            uint8_t *p = &buf[(((my >> 1) + band) * fb->stride + mx) >> 2];
+            uint8_t bytes[2] = {0, 0};
+            for (int bit = 0; bit < 16; bit++) {
+                int col = bit >> 1, row = (band << 1) + (bit & 1);
+                int v = (b >> ((row << 3) + col)) & 1;
+                bytes[col >> 2] |= v << (7 - (((col & 3) << 1) + (bit & 1)));
+            }
+            p[0] = bytes[0];
+            p[1] = bytes[1];
+        }
+        return true;
+    }
+    if (!horizontal) {
+        b = block_transpose(b);
+    }
+    if ((fb->format & 0x01) != 0) {
+        b = block_mirror_x(b);
+    }
+    for (int i = 0; i < 8; i++) {
+        if (horizontal) {
+            buf[(mx + (my + i) * fb->stride) >> 3] = b >> (i << 3);
+        } else {
+            buf[mx + i + (my >> 3) * fb->stride] = b >> (i << 3);
+        }
+    }
+    return true;
+}
+
+// Converts columns x0..x1 of row y into row dst_y of dst.
+STATIC void convert_span(const mp_obj_framebuf_t *src, const mp_obj_framebuf_t *dst, int x0, int x1, int y, int dst_y, const convert_map_t *map, dither_t *dither) {
+    bool same_kind = value_kind(src->format) == value_kind(dst->format);
+    uint32_t vals[CONVERT_CHUNK];
+    dither_row(dither);
+    for (int x = x0; x < x1; x += CONVERT_CHUNK) {
+        int n = MIN(CONVERT_CHUNK, x1 - x);
+        convert_read_row(src, x, y, n, vals);
+        if (map->palette) {
+            for (int i = 0; i < n; i++) {
+                vals[i] = getpixel(map->palette, vals[i], 0);
+            }
+        } else if (map->has_matrix || !same_kind) {
+            for (int i = 0; i < n; i++) {
+                uint32_t argb = fb_pixel_to_argb(src, vals[i]);
+                if (map->has_matrix) {
+                    argb = convert_matrix(map->matrix, argb);
+                }
+                if (dither->mode != FRAMEBUF_DITHER_NONE) {
+                    vals[i] = dither_grey(dither, x + i, dst_y, argb_to_grey(argb));
+                } else {
+                    vals[i] = fb_argb_to_pixel(dst, argb);
+                }
+            }
+        }
+        convert_write_row(dst, x, dst_y, n, vals);
+    }
+}
+
+// Converts rows y0..y1 of src into dst from row dst_y, over the width the
+// two buffers share. Between 1-bit layouts, rotations and mirrors whole
+// 8x8 blocks are moved at a time.
+STATIC void convert_rows(const mp_obj_framebuf_t *src, const mp_obj_framebuf_t *dst, int y0, int y1, int dst_y, const convert_map_t *map) {
+    int w = MIN(src->width, dst->width);
+    bool plain = !map->palette && !map->has_matrix;
+    dither_t dither;
+    dither_init(&dither, map->palette ? FRAMEBUF_DITHER_NONE : map->dither, dst->format, w);
+    if (plain && value_kind(src->format) == FRAMEBUF_MON_VLSB && value_kind(dst->format) == FRAMEBUF_MON_VLSB
+        && !(src->format == dst->format && (src->format & 0xFC) == 0)) {
+        int w8 = w & ~7;
+        for (; y0 + 8 <= y1; y0 += 8, dst_y += 8) {
+            for (int x = 0; x < w8; x += 8) {
+                uint64_t block;
+                if (mono_block_load(src, x, y0, &block) && mono_block_store(dst, x, dst_y, block)) {
+                    continue;
+                }
+                for (int i = 0; i < 8; i++) {
+                    convert_span(src, dst, x, x + 8, y0 + i, dst_y + i, map, &dither);
+                }
+            }
+            for (int i = 0; i < 8 && w8 < w; i++) {
+                convert_span(src, dst, w8, w, y0 + i, dst_y + i, map, &dither);
+            }
+        }
+    }
+    for (int y = y0; y < y1; y++, dst_y++) {
+        if (plain && blit_same_format(dst, src, 0, dst_y, 0, y, w, 1, FRAMEBUF_ROP_COPY)) {
+            continue;
+        }
+        convert_span(src, dst, 0, w, y, dst_y, map, &dither);
+    }
+    dither_deinit(&dither);
+}
 
-STATIC mp_int_t poly_int(mp_buffer_info_t *bufinfo, size_t index) {
-    return mp_obj_get_int(mp_binary_get_val_array(bufinfo->typecode, bufinfo->buf, index));
+STATIC mp_obj_framebuf_t *convert_dst_arg(mp_obj_t arg) {
+    mp_obj_t dst_in = mp_obj_cast_to_native_base(arg, MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (dst_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    return MP_OBJ_TO_PTR(dst_in);
 }
 
-STATIC mp_obj_t framebuf_poly(size_t n_args, const mp_obj_t *args_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+STATIC mp_obj_t framebuf_convert(size_t n_args, const mp_obj_t *args) {
+    // convert(dst[, palette_or_matrix[, dither]]): copy this buffer into dst,
+    // changing format and orientation as needed.
+    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_obj_framebuf_t *dst = framebuf_writable(convert_dst_arg(args[1]));
+    convert_map_t map;
+    convert_map_arg(&map, n_args, args, 2);
+    convert_rows(self, dst, 0, MIN(self->height, dst->height), 0, &map);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_convert_obj, 2, 4, framebuf_convert);
 
-    mp_int_t x = mp_obj_get_int(args_in[1]);
-    mp_int_t y = mp_obj_get_int(args_in[2]);
+STATIC mp_obj_t framebuf_convert_rows(size_t n_args, const mp_obj_t *args) {
+    // convert_rows(dst, y0, y1[, palette_or_matrix[, dither]]): convert rows
+    // y0..y1-1 into rows 0.. of dst, e.g. a small band buffer streamed to a
+    // panel.
+    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_obj_framebuf_t *dst = framebuf_writable(convert_dst_arg(args[1]));
+    mp_int_t y0 = MAX(0, mp_obj_get_int(args[2]));
+    mp_int_t y1 = MIN(self->height, mp_obj_get_int(args[3]));
+    y1 = MIN(y1, y0 + dst->height);
+    convert_map_t map;
+    convert_map_arg(&map, n_args, args, 4);
+    if (y0 < y1) {
+        convert_rows(self, dst, y0, y1, 0, &map);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_convert_rows_obj, 4, 6, framebuf_convert_rows);
+
+// Memory layout of a buffer: lines of line_bytes bytes, each holding lh
+// pixels along b and a_len pixels along a. a runs along x unless swap.
+typedef struct _mem_layout_t {
+    bool swap;
+    uint8_t ppb;        // pixels per byte along a line
+    uint8_t bpp;        // bytes per ppb pixels
+    uint8_t lh;         // pixels along b in one line
+    int a_len, b_len;
+    size_t line_bytes;
+} mem_layout_t;
+
+STATIC void mem_layout(const mp_obj_framebuf_t *fb, mem_layout_t *m) {
+    static const uint8_t rgb_bytes[4] = { 2, 2, 3, 4 };
+    bool mv = (fb->format & FRAMEBUF_MV) != 0;
+    int rows = fb->band_h ? fb->band_h : fb->height;
+    m->swap = mv;
+    m->ppb = 1;
+    m->bpp = 1;
+    m->lh = 1;
+    switch (fb->format & 0xE0) {
+        case FRAMEBUF_RGB565 & 0xE0:
+            m->bpp = rgb_bytes[fb->format & 0x03];
+            break;
+        case FRAMEBUF_RGB332 & 0xE0:
+            // RGB444 stores a pixel pair in three bytes.
+            m->ppb = (fb->format & 0x03) == 1 ? 2 : 1;
+            m->bpp = (fb->format & 0x03) == 0 ? 1 : 3;
+            break;
+        case FRAMEBUF_GS8_H & 0xE0:
+            // GS8 ignores MV, GS8_H keeps columns contiguous.
+            m->swap = (fb->format & 0x02) != 0;
+            break;
+        case FRAMEBUF_ST7302:
+            m->ppb = 4;
+            m->lh = 2;
+            break;
+        case FRAMEBUF_PAL2 & 0xE0:
+            m->ppb = 8 / pal_bits(fb->format);
+            break;
+        default: {
+            int per = 8 / grey_bits(fb->format);
+            if (((fb->format & 0x02) != 0) != mv) {
+                m->ppb = per;
+            } else {
+                m->lh = per;
+            }
+            break;
+        }
+    }
+    m->a_len = m->swap ? rows : fb->width;
+    m->b_len = m->swap ? fb->width : rows;
+    m->line_bytes = (size_t)fb->stride * m->bpp / m->ppb;
+}
 
-    mp_buffer_info_t bufinfo;
-    mp_get_buffer_raise(args_in[3], &bufinfo, MP_BUFFER_READ);
-    // If an odd number of values was given, this rounds down to multiple of two.
-    int n_poly = bufinfo.len / (mp_binary_get_size('@', bufinfo.typecode, NULL) * 2);
+// Bytes of the lines that hold h rows of the buffer.
+STATIC size_t band_bytes(const mp_obj_framebuf_t *fb, int h) {
+    mp_obj_framebuf_t band = *fb;
+    band.band_h = h;
+    mem_layout_t m;
+    mem_layout(&band, &m);
+    size_t lines = (m.b_len + m.lh - 1) / m.lh;
+    if (fb->tile) {
+        // whole tiles
+        lines = (lines + (1 << fb->tile) - 1) >> fb->tile << fb->tile;
+    }
+    return lines * m.line_bytes;
+}
 
-    if (n_poly == 0) {
-        return mp_const_none;
+// Converts between a screen rectangle and the stored a/b rectangle; returns
+// false if the rectangle misses the stored rows of a band.
+STATIC bool mem_rect_from_screen(const mp_obj_framebuf_t *fb, const mem_layout_t *m, int x, int y, int w, int h, int *a, int *b) {
+    if ((fb->format & FRAMEBUF_MX) != 0) {
+        x = fb->width - x - w;
+    }
+    if ((fb->format & FRAMEBUF_MY) != 0) {
+        y = fb->height - y - h;
     }
+    int yend = y + h;
+    band_clip(fb, &y, &yend);
+    if (y >= yend) {
+        return false;
+    }
+    int px[2] = { x, x + w };
+    int py[2] = { y - fb->band_y, yend - fb->band_y };
+    memcpy(a, m->swap ? py : px, sizeof(px));
+    memcpy(b, m->swap ? px : py, sizeof(px));
+    return true;
+}
 
-    mp_int_t col = mp_obj_get_int(args_in[4]);
-    bool fill = n_args > 5 && mp_obj_is_true(args_in[5]);
+STATIC mp_obj_t rect_tuple(int x, int y, int w, int h) {
+    mp_obj_t items[4] = {
+        MP_OBJ_NEW_SMALL_INT(x), MP_OBJ_NEW_SMALL_INT(y),
+        MP_OBJ_NEW_SMALL_INT(w), MP_OBJ_NEW_SMALL_INT(h),
+    };
+    return mp_obj_new_tuple(4, items);
+}
 
-    if (fill) {
-        // This implements an integer version of http://alienryderflex.com/polygon_fill/
-
-        // The idea is for each scan line, compute the sorted list of x
-        // coordinates where the scan line intersects the polygon edges,
-        // then fill between each resulting pair.
-
-        // Restrict just to the scan lines that include the vertical extent of
-        // this polygon.
-        mp_int_t y_min = INT_MAX, y_max = INT_MIN;
-        for (int i = 0; i < n_poly; i++) {
-            mp_int_t py = poly_int(&bufinfo, i * 2 + 1);
-            y_min = MIN(y_min, py);
-            y_max = MAX(y_max, py);
-        }
-
-        for (mp_int_t row = y_min; row <= y_max; row++) {
-            // Each node is the x coordinate where an edge crosses this scan line.
-            mp_int_t nodes[n_poly];
-            int n_nodes = 0;
-            mp_int_t px1 = poly_int(&bufinfo, 0);
-            mp_int_t py1 = poly_int(&bufinfo, 1);
-            int i = n_poly * 2 - 1;
-            do {
-                mp_int_t py2 = poly_int(&bufinfo, i--);
-                mp_int_t px2 = poly_int(&bufinfo, i--);
-
-                // Don't include the bottom pixel of a given edge to avoid
-                // duplicating the node with the start of the next edge. This
-                // will miss some pixels on the boundary, and in particular
-                // at a local minima or inflection point.
-                if (py1 != py2 && ((py1 > row && py2 <= row) || (py1 <= row && py2 > row))) {
-                    mp_int_t node = (32 * px1 + 32 * (px2 - px1) * (row - py1) / (py2 - py1) + 16) / 32;
-                    nodes[n_nodes++] = node;
-                } else if (row == MAX(py1, py2)) {
-                    // At local-minima, try and manually fill in the pixels that get missed above.
-                    if (py1 < py2) {
-                        setpixel_checked(self, x + px2, y + py2, col, 1);
-                    } else if (py2 < py1) {
-                        setpixel_checked(self, x + px1, y + py1, col, 1);
-                    } else {
-                        // Even though this is a hline and would be faster to
-                        // use fill_rect, use line() because it handles x2 <
-                        // x1.
-                        line(self, x + px1, y + py1, x + px2, y + py2, col);
-                    }
-                }
+STATIC mp_obj_t mem_rect_to_screen(const mp_obj_framebuf_t *fb, const mem_layout_t *m, const int *a, const int *b) {
+    const int *px = m->swap ? b : a;
+    const int *py = m->swap ? a : b;
+    int x = px[0], w = px[1] - px[0];
+    int y = py[0] + fb->band_y, h = py[1] - py[0];
+    if ((fb->format & FRAMEBUF_MX) != 0) {
+        x = fb->width - x - w;
+    }
+    if ((fb->format & FRAMEBUF_MY) != 0) {
+        y = fb->height - y - h;
+    }
+    return rect_tuple(x, y, w, h);
+}
 
-                px1 = px2;
-                py1 = py2;
-            } while (i >= 0);
+// Whether the bytes holding stored rectangle a x b differ.
+STATIC bool mem_rect_differs(const uint8_t *p, const uint8_t *q, const mem_layout_t *m, const int *a, const int *b) {
+    size_t k0 = (size_t)a[0] * m->bpp / m->ppb;
+    size_t k1 = ((size_t)a[1] * m->bpp + m->ppb - 1) / m->ppb;
+    for (int line = b[0] / m->lh; line <= (b[1] - 1) / m->lh; ++line) {
+        size_t off = line * m->line_bytes + k0;
+        if (memcmp(&p[off], &q[off], k1 - k0) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
-            if (!n_nodes) {
-                continue;
+// Whether the pixels of a screen rectangle differ, for tiled buffers whose
+// memory has no lines to compare.
+STATIC bool pixels_differ(const mp_obj_framebuf_t *p, const mp_obj_framebuf_t *q, int x, int y, int w, int h) {
+    for (int yy = y; yy < y + h; yy++) {
+        for (int xx = x; xx < x + w; xx++) {
+            if (getpixel(p, xx, yy) != getpixel(q, xx, yy)) {
+                return true;
             }
+        }
+    }
+    return false;
+}
 
-            // Sort the nodes left-to-right (bubble-sort for code size).
-            i = 0;
-            while (i < n_nodes - 1) {
-                if (nodes[i] > nodes[i + 1]) {
-                    mp_int_t swap = nodes[i];
-                    nodes[i] = nodes[i + 1];
-                    nodes[i + 1] = swap;
-                    if (i) {
-                        i--;
-                    }
-                } else {
-                    i++;
+STATIC mp_obj_framebuf_t *same_layout_arg(const mp_obj_framebuf_t *self, mp_obj_t arg) {
+    mp_obj_framebuf_t *other = convert_dst_arg(arg);
+    if (other->format != self->format || other->width != self->width || other->height != self->height
+        || other->stride != self->stride || other->band_y != self->band_y || other->band_h != self->band_h
+        || other->tile != self->tile) {
+        mp_raise_ValueError(MP_ERROR_TEXT("FrameBuffers must have the same layout"));
+    }
+    return other;
+}
+
+STATIC mp_obj_t framebuf_diff(size_t n_args, const mp_obj_t *args) {
+    // diff(other[, tile_w[, tile_h]]): compare with a buffer of the same
+    // layout. Without a tile size return the bounding (x, y, w, h) of the
+    // changes or None; with one return the list of changed tiles. Memory is
+    // compared bytewise, so pixels sharing a byte with a change count too.
+    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_obj_framebuf_t *other = same_layout_arg(self, args[1]);
+    const uint8_t *p = self->buf;
+    const uint8_t *q = other->buf;
+    mem_layout_t m;
+    mem_layout(self, &m);
+
+    if (n_args == 2 && self->tile) {
+        int x0 = self->width, y0 = self->height, x1 = 0, y1 = 0;
+        for (int y = 0; y < self->height; y++) {
+            for (int x = 0; x < self->width; x++) {
+                if (getpixel(self, x, y) != getpixel(other, x, y)) {
+                    x0 = MIN(x0, x);
+                    y0 = MIN(y0, y);
+                    x1 = MAX(x1, x + 1);
+                    y1 = y + 1;
                 }
             }
+        }
+        return x0 < x1 ? rect_tuple(x0, y0, x1 - x0, y1 - y0) : mp_const_none;
+    }
+    if (n_args == 2) {
+        size_t len = ((size_t)m.a_len * m.bpp + m.ppb - 1) / m.ppb;
+        int lines = (m.b_len + m.lh - 1) / m.lh;
+        size_t k0 = len, k1 = 0;
+        int l0 = lines, l1 = 0;
+        for (int line = 0; line < lines; ++line) {
+            const uint8_t *pl = &p[line * m.line_bytes];
+            const uint8_t *ql = &q[line * m.line_bytes];
+            if (memcmp(pl, ql, len) == 0) {
+                continue;
+            }
+            size_t k = 0, kend = len;
+            while (pl[k] == ql[k]) {
+                ++k;
+            }
+            while (pl[kend - 1] == ql[kend - 1]) {
+                --kend;
+            }
+            k0 = MIN(k0, k);
+            k1 = MAX(k1, kend);
+            l0 = MIN(l0, line);
+            l1 = line + 1;
+        }
+        if (l0 >= l1) {
+            return mp_const_none;
+        }
+        int a[2] = { (int)(k0 * m.ppb / m.bpp), MIN(m.a_len, (int)((k1 * m.ppb + m.bpp - 1) / m.bpp)) };
+        int b[2] = { l0 * m.lh, MIN(m.b_len, l1 * m.lh) };
+        return mem_rect_to_screen(self, &m, a, b);
+    }
 
-            // Fill between each pair of nodes.
-            for (i = 0; i < n_nodes; i += 2) {
-                fill_rect(self, x + nodes[i], y + row, (nodes[i + 1] - nodes[i]) + 1, 1, col);
+    mp_int_t tw = mp_obj_get_int(args[2]);
+    mp_int_t th = n_args > 3 ? mp_obj_get_int(args[3]) : tw;
+    if (tw < 1 || th < 1) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid tile size"));
+    }
+    mp_obj_t tiles = mp_obj_new_list(0, NULL);
+    for (int y = 0; y < self->height; y += th) {
+        int h = MIN(th, self->height - y);
+        for (int x = 0; x < self->width; x += tw) {
+            int w = MIN(tw, self->width - x);
+            int a[2], b[2];
+            if (self->tile ? pixels_differ(self, other, x, y, w, h)
+                : mem_rect_from_screen(self, &m, x, y, w, h, a, b) && mem_rect_differs(p, q, &m, a, b)) {
+                mp_obj_list_append(tiles, rect_tuple(x, y, w, h));
             }
         }
-    } else {
-        // Outline only.
-        mp_int_t px1 = poly_int(&bufinfo, 0);
-        mp_int_t py1 = poly_int(&bufinfo, 1);
-        int i = n_poly * 2 - 1;
-        do {
-            mp_int_t py2 = poly_int(&bufinfo, i--);
-            mp_int_t px2 = poly_int(&bufinfo, i--);
-            line(self, x + px1, y + py1, x + px2, y + py2, col);
-            px1 = px2;
-            py1 = py2;
-        } while (i >= 0);
     }
+    return tiles;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_diff_obj, 2, 4, framebuf_diff);
 
+STATIC mp_obj_t framebuf_swap_buffers(mp_obj_t self_in, mp_obj_t other_in) {
+    // swap_buffers(other): exchange the memory of two buffers of the same
+    // layout without copying, e.g. the drawn frame and the one on the panel.
+    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_framebuf_t *other = same_layout_arg(self, other_in);
+    void *buf = self->buf;
+    mp_obj_t buf_obj = self->buf_obj;
+    bool read_only = self->read_only;
+    uint32_t *palette = self->palette;
+    self->buf = other->buf;
+    self->buf_obj = other->buf_obj;
+    self->read_only = other->read_only;
+    self->palette = other->palette;
+    other->buf = buf;
+    other->buf_obj = buf_obj;
+    other->read_only = read_only;
+    other->palette = palette;
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_poly_obj, 5, 6, framebuf_poly);
-#endif // MICROPY_PY_ARRAY && !MICROPY_ENABLE_DYNRUNTIME
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(framebuf_swap_buffers_obj, framebuf_swap_buffers);
 
-STATIC mp_obj_t framebuf_blit(size_t n_args, const mp_obj_t *args) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
-    mp_obj_t source_in = mp_obj_cast_to_native_base(args[1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
-    if (source_in == MP_OBJ_NULL) {
-        mp_raise_TypeError(NULL);
+// Iterator of iter_rows(): converts a few rows at a time into a scratch
+// buffer and yields the bytes as the panel takes them.
+typedef struct _mp_obj_row_iter_t {
+    mp_obj_base_t base;
+    mp_obj_t src_obj;
+    mp_obj_framebuf_t chunk;    // over the scratch buffer, in the panel's format
+    convert_map_t map;
+    fb_size_t rows, y;
+} mp_obj_row_iter_t;
+
+// Sizes chunk for n rows with its default stride; returns its bytes.
+STATIC size_t row_chunk_setup(mp_obj_framebuf_t *chunk, int n) {
+    mem_layout_t m;
+    chunk->height = n;
+    mem_layout(chunk, &m);
+    chunk->stride = format_stride(chunk->format, m.swap ? n : chunk->width);
+    mem_layout(chunk, &m);
+    return (m.b_len + m.lh - 1) / m.lh * m.line_bytes;
+}
+
+STATIC mp_obj_t row_iter_next(mp_obj_t self_in) {
+    mp_obj_row_iter_t *self = MP_OBJ_TO_PTR(self_in);
+    const mp_obj_framebuf_t *src = MP_OBJ_TO_PTR(self->src_obj);
+    if (self->y >= src->height) {
+        return MP_OBJ_STOP_ITERATION;
     }
-    mp_obj_framebuf_t *source = MP_OBJ_TO_PTR(source_in);
+    int n = MIN(self->rows, src->height - self->y);
+    size_t len = row_chunk_setup(&self->chunk, n);
+    convert_rows(src, &self->chunk, self->y, self->y + n, 0, &self->map);
+    self->y += n;
+    return mp_obj_new_bytearray_by_ref(len, self->chunk.buf);
+}
 
-    mp_int_t x = mp_obj_get_int(args[2]);
-    mp_int_t y = mp_obj_get_int(args[3]);
-    mp_int_t key = -1;
-    if (n_args > 4) {
-        key = mp_obj_get_int(args[4]);
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_type_row_iter,
+    MP_QSTR_iterator,
+    MP_TYPE_FLAG_ITER_IS_ITERNEXT,
+    iter, row_iter_next
+    );
+
+STATIC mp_obj_t framebuf_iter_rows(size_t n_args, const mp_obj_t *args) {
+    // iter_rows(format, rows_per_chunk, scratch_buf[, palette_or_matrix[,
+    // dither]]): iterate over the buffer rows_per_chunk rows at a time,
+    // converted to format in scratch_buf. Each item is a bytearray over
+    // scratch_buf holding just that chunk, so it must be sent before the
+    // next one is taken.
+    mp_obj_row_iter_t *o = m_new_obj(mp_obj_row_iter_t);
+    o->base.type = &mp_type_row_iter;
+    o->src_obj = args[0];
+    const mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_int_t rows = mp_obj_get_int(args[2]);
+    if (rows < 1 || rows > FRAMEBUF_SIZE_MAX) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid rows"));
     }
-    mp_obj_framebuf_t *palette = NULL;
-    if (n_args > 5 && args[5] != mp_const_none) {
-        palette = MP_OBJ_TO_PTR(mp_obj_cast_to_native_base(args[5], MP_OBJ_FROM_PTR(&mp_type_framebuf)));
+    o->rows = rows;
+    o->y = 0;
+    mp_obj_framebuf_t *chunk = &o->chunk;
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->base.type = &mp_type_framebuf;
+    chunk->buf_obj = args[3];
+    chunk->format = mp_obj_get_int(args[1]);
+    chunk->width = self->width;
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[3], &bufinfo, MP_BUFFER_WRITE);
+    chunk->buf = bufinfo.buf;
+    if (bufinfo.len < row_chunk_setup(chunk, MIN(rows, self->height))) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buffer too small"));
     }
+    convert_map_arg(&o->map, n_args, args, 4);
+    return MP_OBJ_FROM_PTR(o);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_iter_rows_obj, 4, 6, framebuf_iter_rows);
 
-    if (
-        (x >= self->width) ||
-        (y >= self->height) ||
-        (-x >= source->width) ||
-        (-y >= source->height)
-        ) {
-        // Out of bounds, no-op.
+STATIC mp_obj_t framebuf_palette(size_t n_args, const mp_obj_t *args) {
+    // palette(i[, rgb]): read or set entry i of a PAL buffer's palette as
+    // 0xRRGGBB. palette(colours[, start]): set the entries from start on
+    // from a sequence of colours.
+    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
+    if (!self->palette) {
+        mp_raise_ValueError(MP_ERROR_TEXT("FrameBuffer has no palette"));
+    }
+    mp_int_t n = 1 << pal_bits(self->format);
+    if (mp_obj_is_int(args[1])) {
+        mp_int_t i = mp_obj_get_int(args[1]);
+        if (i < 0 || i >= n) {
+            mp_raise_ValueError(MP_ERROR_TEXT("invalid palette index"));
+        }
+        if (n_args == 2) {
+            return MP_OBJ_NEW_SMALL_INT(self->palette[i]);
+        }
+        self->palette[i] = mp_obj_get_int(args[2]) & 0xffffff;
         return mp_const_none;
     }
-
-    // Clip.
-    int x0 = MAX(0, x);
-    int y0 = MAX(0, y);
-    int x1 = MAX(0, -x);
-    int y1 = MAX(0, -y);
-    int x0end = MIN(self->width, x + source->width);
-    int y0end = MIN(self->height, y + source->height);
-
-    for (; y0 < y0end; ++y0) {
-        int cx1 = x1;
-        for (int cx0 = x0; cx0 < x0end; ++cx0) {
-            uint32_t col = getpixel(source, cx1, y1);
-            if (palette) {
-                col = getpixel(palette, col, 0);
-            }
-            if (col != (uint32_t)key) {
-                setpixel(self, cx0, y0, col);
-            }
-            ++cx1;
+    mp_int_t i = n_args > 2 ? mp_obj_get_int(args[2]) : 0;
+    mp_obj_t iter = mp_getiter(args[1], NULL);
+    mp_obj_t item;
+    while ((item = mp_iternext(iter)) != MP_OBJ_STOP_ITERATION) {
+        if (i < 0 || i >= n) {
+            mp_raise_ValueError(MP_ERROR_TEXT("invalid palette index"));
         }
-        ++y1;
+        self->palette[i++] = mp_obj_get_int(item) & 0xffffff;
     }
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_blit_obj, 4, 6, framebuf_blit);
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_palette_obj, 2, 3, framebuf_palette);
+
+STATIC mp_obj_t framebuf_linearize(size_t n_args, const mp_obj_t *args) {
+    // linearize(buf[, y[, h]]): copy screen rows y..y+h-1 into buf as plain
+    // lines of width pixels in the buffer's format, the order panels take
+    // them in. Unmirrored tiled buffers are copied a tile line at a time.
+    // Returns the bytes written.
+    const mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[1], &bufinfo, MP_BUFFER_WRITE);
+    mp_int_t y0 = n_args > 2 ? mp_obj_get_int(args[2]) : 0;
+    mp_int_t h = n_args > 3 ? mp_obj_get_int(args[3]) : self->height - y0;
+    int bpp = tile_pixel_bytes(self->format);
+    if (bpp == 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("linearize needs whole-byte pixels"));
+    }
+    if (y0 < 0 || h < 0 || y0 + h > self->height) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid rows"));
+    }
+    size_t line = (size_t)self->width * bpp;
+    if (bufinfo.len < line * h) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buffer too small"));
+    }
+    uint8_t *out = bufinfo.buf;
+    bool direct = self->tile && !self->band_h && !tile_swap(self->format)
+        && (self->format & (FRAMEBUF_MX | FRAMEBUF_MY)) == 0;
+    int size = 1 << self->tile;
+    for (int y = y0; y < y0 + h; y++, out += line) {
+        if (direct) {
+            for (int x = 0; x < self->width; x += size) {
+                memcpy(&out[x * bpp], tile_addr(self, x, y), MIN(size, self->width - x) * bpp);
+            }
+            continue;
+        }
+        for (int x = 0; x < self->width; x++) {
+            tile_store(&out[x * bpp], self->format, getpixel(self, x, y));
+        }
+    }
+    return mp_obj_new_int(line * h);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_linearize_obj, 2, 4, framebuf_linearize);
 
 STATIC mp_obj_t framebuf_scroll(mp_obj_t self_in, mp_obj_t xstep_in, mp_obj_t ystep_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(self_in));
     mp_int_t xstep = mp_obj_get_int(xstep_in);
     mp_int_t ystep = mp_obj_get_int(ystep_in);
     int sx, y, xend, yend, dx, dy;
@@ -1472,21 +4963,13 @@ uint32_t getasc(uint8_t f_style,uint8_t chr,uint8_t * chr_data,uint8_t * font_wi
     return 0;
 }
 
-STATIC mp_obj_t framebuf_text(size_t n_args, const mp_obj_t *args) {
-    // extract arguments
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
-    const char *str = mp_obj_str_get_str(args[1]);
-    mp_int_t x0 = mp_obj_get_int(args[2]);
-    mp_int_t y0 = mp_obj_get_int(args[3]);
-    mp_int_t col = 1;
+// Draws str in the current font with its top left corner at x0, y0.
+STATIC void draw_text(mp_obj_framebuf_t *self, const char *str, mp_int_t x0, mp_int_t y0, mp_int_t col) {
     uint8_t chr_data[130];
     uint32_t mask,unicode;
     uint8_t utf8len;
     uint8_t ret=1;
     uint8_t font_width,font_high,font_stride=2;
-    if (n_args >= 5) {
-        col = mp_obj_get_int(args[4]);
-    }
 
     // loop over chars
     for (; *str; ++str) {
@@ -1605,6 +5088,19 @@ STATIC mp_obj_t framebuf_text(size_t n_args, const mp_obj_t *args) {
             }
         }
     }
+}
+
+STATIC mp_obj_t framebuf_text(size_t n_args, const mp_obj_t *args) {
+    // extract arguments
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args[0]));
+    const char *str = mp_obj_str_get_str(args[1]);
+    mp_int_t x0 = mp_obj_get_int(args[2]);
+    mp_int_t y0 = mp_obj_get_int(args[3]);
+    mp_int_t col = 1;
+    if (n_args >= 5) {
+        col = mp_obj_get_int(args[4]);
+    }
+    draw_text(self, str, x0, y0, col);
     return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_text_obj, 4, 5, framebuf_text);
@@ -1631,61 +5127,188 @@ typedef struct __attribute__((packed)) tagBITMAPFILEHEADER
        
 } BITMAPFILEHEADER;     
 
-STATIC mp_obj_t framebuf_show_bmp(size_t n_args, const mp_obj_t *args) {
-    // extract arguments
-    BITMAPFILEHEADER bmp_h;
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
-    const char *filename = mp_obj_str_get_str(args[1]);
-    mp_int_t inv = 0;
-    if (n_args > 2) {
-        inv = mp_obj_get_int(args[2]);
+// Where show_bmp reads and save_bmp writes: a file opened by name, a stream
+// given by the caller, or a buffer used in place.
+typedef struct _bmp_io_t {
+    mp_obj_t stream;            // MP_OBJ_NULL for a buffer
+    uint8_t *buf;
+    size_t len, pos;
+    bool close;                 // opened here from a file name
+} bmp_io_t;
+
+STATIC void bmp_io_open(bmp_io_t *io, mp_obj_t arg, bool write) {
+    io->stream = MP_OBJ_NULL;
+    io->buf = NULL;
+    io->len = 0;
+    io->pos = 0;
+    io->close = false;
+    if (mp_obj_is_str(arg)) {
+        mp_obj_t f_args[2] = {
+            arg,
+            MP_OBJ_NEW_QSTR(write ? MP_QSTR_wb : MP_QSTR_rb),
+        };
+        io->stream = mp_vfs_open(MP_ARRAY_SIZE(f_args), &f_args[0], (mp_map_t *)&mp_const_empty_map);
+        io->close = true;
+        return;
     }
-    mp_int_t x0 = 0;
-    mp_int_t y0 = 0;
-    if (n_args > 4) {
-        x0 = mp_obj_get_int(args[3]);
-        y0 = mp_obj_get_int(args[4]);
-    } 
-    mp_int_t w = self->width-x0;
-    mp_int_t h = self->height-y0;
-    if (n_args > 6) {
-        w = MIN(mp_obj_get_int(args[5]),w);
-        h = MIN(mp_obj_get_int(args[6]),h);
+    mp_buffer_info_t bufinfo;
+    if (mp_get_buffer(arg, &bufinfo, write ? MP_BUFFER_WRITE : MP_BUFFER_READ)) {
+        io->buf = bufinfo.buf;
+        io->len = bufinfo.len;
+        return;
     }
-    mp_obj_t f_args[2] = {
-        mp_obj_new_str(filename, strlen(filename)),
-        MP_OBJ_NEW_QSTR(MP_QSTR_rb),
-    }; 
-    mp_obj_t bmp_file = mp_vfs_open(MP_ARRAY_SIZE(f_args), &f_args[0], (mp_map_t *)&mp_const_empty_map);
-    int errcode;
-    int len=mp_stream_rw(bmp_file ,&bmp_h, sizeof(BITMAPFILEHEADER), &errcode, MP_STREAM_OP_READ);
-    if (errcode != 0 && len!=sizeof(BITMAPFILEHEADER)) {
-        mp_raise_OSError(errcode);
+    mp_get_stream_raise(arg, write ? MP_STREAM_OP_WRITE : MP_STREAM_OP_READ);
+    io->stream = arg;
+}
+
+STATIC void bmp_io_close(bmp_io_t *io) {
+    if (io->close) {
+        mp_stream_close(io->stream);
+    }
+}
+
+// Returns the next n bytes, in place for a buffer or read into scratch for
+// a stream; NULL if the data ends first.
+STATIC const uint8_t *bmp_io_read(bmp_io_t *io, void *scratch, size_t n) {
+    if (io->stream == MP_OBJ_NULL) {
+        if (io->len - io->pos < n) {
+            io->pos = io->len;
+            return NULL;
+        }
+        io->pos += n;
+        return io->buf + io->pos - n;
+    }
+    int errcode = 0;
+    mp_uint_t len = mp_stream_rw(io->stream, scratch, n, &errcode, MP_STREAM_OP_READ);
+    io->pos += len;
+    if (len != n) {
+        if (errcode != 0) {
+            mp_raise_OSError(errcode);
+        }
+        return NULL;
+    }
+    return scratch;
+}
+
+STATIC void bmp_io_write(bmp_io_t *io, const void *data, size_t n) {
+    if (io->stream == MP_OBJ_NULL) {
+        if (io->len - io->pos < n) {
+            mp_raise_ValueError(MP_ERROR_TEXT("buffer too small"));
+        }
+        memcpy(io->buf + io->pos, data, n);
+    } else {
+        int errcode = 0;
+        if (mp_stream_rw(io->stream, (void *)data, n, &errcode, MP_STREAM_OP_WRITE) != n) {
+            mp_raise_OSError(errcode != 0 ? errcode : MP_EIO);
+        }
+    }
+    io->pos += n;
+}
+
+// Moves to offset pos. Streams skip forward by reading, so sockets and
+// other unseekable streams work for the usual header sizes.
+STATIC void bmp_io_seek(bmp_io_t *io, size_t pos) {
+    if (io->stream == MP_OBJ_NULL) {
+        io->pos = MIN(pos, io->len);
+    } else if (pos < io->pos) {
+        io->pos = f_seek(io->stream, pos, SEEK_SET);
+    } else {
+        uint8_t skip[32];
+        while (io->pos < pos && bmp_io_read(io, skip, MIN(sizeof(skip), pos - io->pos)) != NULL) {
+        }
+    }
+}
+
+// Decoding state of show_bmp, kept between calls by BmpLoader.
+typedef struct _bmp_decoder_t {
+    mp_obj_framebuf_t *fb;
+    bmp_io_t io;
+    BITMAPFILEHEADER head;
+    const char *name;
+    mp_int_t inv, x0, y0, w, h;
+    uint32_t stride;        // bytes of a file row
+    int32_t hh;             // file rows left, stored bottom up
+    dither_t dither;
+    uint8_t *line_buf;      // stride bytes, set by the caller after bmp_begin
+    uint8_t map[256];       // PAL value of each colour index of the file
+} bmp_decoder_t;
+
+// Takes the colour table of a palettized file into a PAL buffer. Colours
+// beyond the buffer's palette are drawn with the nearest entry.
+STATIC void bmp_load_palette(bmp_decoder_t *d, const BITMAPFILEHEADER *h) {
+    mp_obj_framebuf_t *fb = d->fb;
+    int size = 1 << pal_bits(fb->format);
+    int n = 1 << h->biBitcount;
+    if (h->biClrUsed && h->biClrUsed < (uint32_t)n) {
+        n = h->biClrUsed;
+    }
+    n = MIN(n, MAX(0, ((int)h->bfOffBits - 14 - (int)h->biHSize) / 4));
+    memset(d->map, 0, sizeof(d->map));
+    bmp_io_seek(&d->io, 14 + h->biHSize);
+    for (int i = 0; i < n; i++) {
+        uint8_t q[4];
+        const uint8_t *p = bmp_io_read(&d->io, q, 4);
+        if (p == NULL) {
+            break;
+        }
+        uint32_t col = (p[2] << 16) | (p[1] << 8) | p[0];
+        if (i < size) {
+            fb->palette[i] = col;
+            d->map[i] = i;
+        } else {
+            d->map[i] = fb_argb_to_pixel(fb, 0xff000000 | col);
+        }
+    }
+}
+
+// Reads the headers and gets ready to draw the rows; prints the reason and
+// returns false if the file can't be shown.
+STATIC bool bmp_read_head(bmp_decoder_t *d, mp_obj_framebuf_t *self, mp_int_t inv,
+    mp_int_t x0, mp_int_t y0, mp_int_t w, mp_int_t h, mp_int_t dither_mode) {
+    BITMAPFILEHEADER bmp_h;
+    const char *filename = d->name;
+    const uint8_t *head=bmp_io_read(&d->io, &bmp_h, sizeof(BITMAPFILEHEADER));
+    if (head==NULL) {
         mp_printf(&mp_plat_print,"read file hard %s error!\r\n",filename);
+        return false;
+    }
+    if (head!=(const uint8_t *)&bmp_h){
+        memcpy(&bmp_h,head,sizeof(BITMAPFILEHEADER));
     }
     if (bmp_h.bfType!=0x4d42){
         mp_printf(&mp_plat_print,"File %s not BMP.\r\n",filename);
-        return mp_const_none;
+        return false;
     }
-    if ((self->format&0xE0)==(FRAMEBUF_RGB565&0xE0)){
+    if (bmp_h.biHSize<0x28){
+        // OS/2 BITMAPCOREHEADER: 16-bit sizes and 3-byte colour table
+        // entries, which the fields above don't describe.
+        mp_printf(&mp_plat_print,"File %s header not supported.\r\n",filename);
+        return false;
+    }
+    if (rgb_format(self->format)){
         if (bmp_h.biBitcount!=0x18){
             mp_printf(&mp_plat_print,"File %s color no match.\r\n",filename);
-            return mp_const_none;
+                return false;
         }
     }else if(((self->format&0xE0)==(FRAMEBUF_MON_VLSB&0xE0))||((self->format&0xE0)==(FRAMEBUF_ST7302&0xE0))){
-        if (bmp_h.biBitcount!=0x01){
+        if (bmp_h.biBitcount!=0x01 && bmp_h.biBitcount!=0x08 && bmp_h.biBitcount!=0x18){
             mp_printf(&mp_plat_print,"File %s color no match.\r\n",filename);
-            return mp_const_none;
+                return false;
         }
     }else if (((self->format&0xE0)==(FRAMEBUF_GS2_HMSB&0xE0))  || ((self->format&0xE0)==(FRAMEBUF_GS4_HMSB&0xE0)) \
         || ((self->format&0xE0)==(FRAMEBUF_GS8_H&0xE0))){
-        if (bmp_h.biBitcount!=0x08){
+        if (bmp_h.biBitcount!=0x08 && bmp_h.biBitcount!=0x18){
             mp_printf(&mp_plat_print,"File %s color no match.\r\n",filename);
-            return mp_const_none;
+                return false;
         }        
+    }else if ((self->format&0xE0)==(FRAMEBUF_PAL2&0xE0)){
+        if (bmp_h.biBitcount!=0x01 && bmp_h.biBitcount!=0x04 && bmp_h.biBitcount!=0x08){
+            mp_printf(&mp_plat_print,"File %s color no match.\r\n",filename);
+                return false;
+        }
     }else {
         mp_printf(&mp_plat_print,"Unsupported format. \r\n");
-        return mp_const_none;
+        return false;
     }
     if (x0<0 && abs(x0)>bmp_h.biWidth) x0=-bmp_h.biWidth;
     if (y0<0 && abs(y0)>bmp_h.biHeight) y0=-bmp_h.biHeight;
@@ -1697,204 +5320,297 @@ STATIC mp_obj_t framebuf_show_bmp(size_t n_args, const mp_obj_t *args) {
     
     w=MIN(bmp_h.biWidth,w);
     h=MIN(bmp_h.biHeight,h);
-    f_seek(bmp_file, bmp_h.bfOffBits,SEEK_SET);
+    if ((self->format&0xE0)==(FRAMEBUF_PAL2&0xE0)){
+        bmp_load_palette(d, &bmp_h);
+    }
+    bmp_io_seek(&d->io, bmp_h.bfOffBits);
+    // rows are padded to 4 bytes
+    d->stride=((bmp_h.biWidth*bmp_h.biBitcount+0x1F)&(~0x1F))/8;
+    if (!rgb_format(self->format) && bmp_h.biBitcount!=0x01){
+        dither_init(&d->dither,dither_mode,self->format,w);
+    }
+    d->head=bmp_h;
+    d->inv=inv;
+    d->x0=x0;
+    d->y0=y0;
+    d->w=w;
+    d->h=h;
+    d->hh=bmp_h.biHeight;
+    return true;
+}
+
+// Opens the image and reads its header; prints the reason and returns
+// false if it cannot be shown on fb.
+STATIC bool bmp_begin(bmp_decoder_t *d, mp_obj_framebuf_t *self, mp_obj_t file, mp_int_t inv,
+    mp_int_t x0, mp_int_t y0, mp_int_t w, mp_int_t h, mp_int_t dither_mode) {
+    d->fb = self;
+    d->name = mp_obj_is_str(file) ? mp_obj_str_get_str(file) : "data";
+    d->hh = 0;
+    d->dither.err = NULL;
+    bmp_io_open(&d->io, file, false);
+    // A file opened here is closed again if reading it fails or raises.
+    bool ok = false;
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        ok = bmp_read_head(d, self, inv, x0, y0, w, h, dither_mode);
+        nlr_pop();
+    } else {
+        bmp_io_close(&d->io);
+        nlr_jump(nlr.ret_val);
+    }
+    if (!ok) {
+        bmp_io_close(&d->io);
+    }
+    return ok;
+}
+
+STATIC void bmp_end(bmp_decoder_t *d) {
+    dither_deinit(&d->dither);
+    d->dither.err = NULL;
+    bmp_io_close(&d->io);
+    d->hh = 0;
+}
+
+// Reads and draws the next file row; prints the reason, ends the decoding
+// and returns false if the data ends early.
+STATIC bool bmp_step_row(bmp_decoder_t *d) {
+    mp_obj_framebuf_t *self = d->fb;
+    mp_int_t x0 = d->x0, y0 = d->y0, w = d->w, h = d->h;
+    int32_t hh = d->hh--;
+    const uint8_t *row=bmp_io_read(&d->io, d->line_buf, d->stride);
+    if (row==NULL) {
+        mp_printf(&mp_plat_print,"read file %s error!\r\n",d->name);
+        bmp_end(d);
+        return false;
+    }
     if ((self->format&0xE0)==(FRAMEBUF_RGB565&0xE0)){
-        uint32_t stride=(bmp_h.biWidth+3)&(~0x03);
-        uint8_t line_buf[stride][3];
-        int32_t hh,ww;
+        int32_t ww;
         uint16_t dot_col;
-        for(hh=bmp_h.biHeight;hh;hh--){
-            len=mp_stream_rw(bmp_file ,&line_buf, stride*3, &errcode, MP_STREAM_OP_READ);
-            if (errcode != 0 && len!=stride*3) {
-                mp_raise_OSError(errcode);
-                return mp_const_none;
-            }            
-            for(ww=bmp_h.biWidth;ww;ww--){
-                if (ww<=w && hh<=h){
-                    switch(self->format&0x0F){
-                        case 0:
-                        case 1:
-                        dot_col=line_buf[ww-1][0]>>3;
-                        dot_col|=(line_buf[ww-1][1]&0xfc)<<3;
-                        dot_col|=(line_buf[ww-1][2]&0xf8)<<8;
-                        setpixel(self, x0+ww-1, y0+hh-1,dot_col);
-                        break;
-                        case 2:
-                        case 3:
-                        dot_col=line_buf[ww-1][0];
-                        dot_col|=line_buf[ww-1][1]<<8;
-                        dot_col|=line_buf[ww-1][2]<<16;
-                        setpixel(self, x0+ww-1, y0+hh-1,dot_col);
-                    }
+        for(ww=d->head.biWidth;ww;ww--){
+            if (ww<=w && hh<=h){
+                const uint8_t *p=&row[(ww-1)*3];
+                switch(self->format&0x0F){
+                    case 0:
+                    case 1:
+                    dot_col=p[0]>>3;
+                    dot_col|=(p[1]&0xfc)<<3;
+                    dot_col|=(p[2]&0xf8)<<8;
+                    setpixel(self, x0+ww-1, y0+hh-1,dot_col);
+                    break;
+                    case 2:
+                    case 3:
+                    dot_col=p[0];
+                    dot_col|=p[1]<<8;
+                    dot_col|=p[2]<<16;
+                    setpixel(self, x0+ww-1, y0+hh-1,dot_col);
                 }
             }
         }
-    }else if(((self->format&0xE0)==(FRAMEBUF_MON_VLSB&0xE0))||((self->format&0xE0)==(FRAMEBUF_ST7302&0xE0))){
-        uint32_t stride=(bmp_h.biWidth+0x1F)&(~0x1F);
-        uint8_t line_buf[stride/8];
-        int32_t hh,ww;
-        int32_t len;
-        for(hh=bmp_h.biHeight;hh;--hh){
-            len=mp_stream_rw(bmp_file ,&line_buf, stride/8, &errcode, MP_STREAM_OP_READ);
-            if ((errcode != 0) && (len!=stride/8)){
-                mp_printf(&mp_plat_print,"read file %s error!\r\n",filename);
-                return mp_const_none;
-            }
-             for(ww=bmp_h.biWidth;ww;--ww){
-                if (ww<w && hh<h){
-                    if ((line_buf[ww/8]&(0x80>>(ww%8)))==0){
-                        setpixel(self, x0+ww-1, y0+hh-1,inv?0:1);
-                    }else{
-                        setpixel(self, x0+ww-1, y0+hh-1,inv?1:0);
-                    }
-                }
+    }else if ((self->format&0xE0)==(FRAMEBUF_RGB332&0xE0)){
+        int32_t ww;
+        for(ww=d->head.biWidth;ww;ww--){
+            if (ww<=w && hh<=h){
+                const uint8_t *p=&row[(ww-1)*3];
+                uint32_t argb=0xff000000|(p[2]<<16)|(p[1]<<8)|p[0];
+                setpixel(self, x0+ww-1, y0+hh-1,argb_to_rgb(self->format,argb));
             }
         }
-    }else if ((self->format&0xE0)==(FRAMEBUF_GS2_HMSB&0xE0)){
-        uint32_t stride=(bmp_h.biWidth+0x03)&(~0x03);
-        uint8_t line_buf[stride];
-        int32_t hh,ww;
-        for(hh=bmp_h.biHeight;hh;--hh){
-
-            len=mp_stream_rw(bmp_file ,&line_buf, stride, &errcode, MP_STREAM_OP_READ);
-            if ((errcode != 0) && (len!=stride)){
-                mp_printf(&mp_plat_print,"read file %s error!\r\n",filename);
-                return mp_const_none;
-            }
-            for(ww=bmp_h.biWidth;ww;--ww){
-                if (ww<w && hh<h){
-                    if (inv==0){
-                        setpixel(self, x0+ww-1, y0+hh-1,((line_buf[ww-1])>>6)&0x03);
-                    }else{
-                        setpixel(self, x0+ww-1, y0+hh-1,((~line_buf[ww-1])>>6)&0x03);
-                    }
-                }
+    }else if ((self->format&0xE0)==(FRAMEBUF_PAL2&0xE0)){
+        // Colour indices packed from the high bits.
+        int bits=d->head.biBitcount;
+        if (hh<=h){
+            int32_t ww;
+            for(ww=0;ww<w;ww++){
+                int shift=8-bits-(ww*bits&7);
+                uint8_t idx=(row[ww*bits>>3]>>shift)&((1<<bits)-1);
+                setpixel(self, x0+ww, y0+hh-1,d->map[idx]);
             }
         }
-    }else if ((self->format&0xE0)==(FRAMEBUF_GS4_HMSB&0xE0)){
-        uint32_t stride=(bmp_h.biWidth+0x03)&(~0x03);
-        uint8_t line_buf[stride];
-        int32_t hh,ww;
-        for(hh=bmp_h.biHeight;hh;--hh){
-            len=mp_stream_rw(bmp_file ,&line_buf, stride, &errcode, MP_STREAM_OP_READ);
-            if ((errcode != 0) && (len!=stride)){
-                mp_printf(&mp_plat_print,"read file %s error!\r\n",filename);
-                return mp_const_none;
-            }
-            for(ww=bmp_h.biWidth;ww;--ww){
-                if (ww<w && hh<h){
-                    if (inv==0){
-                        setpixel(self, x0+ww-1, y0+hh-1,((line_buf[ww-1])>>4)&0x0f);
-                    }else{
-                        setpixel(self, x0+ww-1, y0+hh-1,((~line_buf[ww-1])>>4)&0x0f);
-                    }
+    }else if(d->head.biBitcount==0x01){
+        int32_t ww;
+        for(ww=d->head.biWidth;ww;--ww){
+            if (ww<w && hh<h){
+                if ((row[ww/8]&(0x80>>(ww%8)))==0){
+                    setpixel(self, x0+ww-1, y0+hh-1,d->inv?0:1);
+                }else{
+                    setpixel(self, x0+ww-1, y0+hh-1,d->inv?1:0);
                 }
             }
         }
-    }else if ((self->format&0xE0)==(FRAMEBUF_GS8_V&0xE0)){
-        uint32_t stride=(bmp_h.biWidth+0x03)&(~0x03);
-        uint8_t line_buf[stride];
-        int32_t hh,ww;
-        for(hh=bmp_h.biHeight;hh;--hh){
-            len=mp_stream_rw(bmp_file ,&line_buf, stride, &errcode, MP_STREAM_OP_READ);
-            if ((errcode != 0) && (len!=stride)){
-                mp_printf(&mp_plat_print,"read file %s error!\r\n",filename);
-                return mp_const_none;
-            }
-            for(ww=bmp_h.biWidth;ww;--ww){
-                if (ww<w && hh<h){
-                    if (inv==0){
-                        setpixel(self, x0+ww-1, y0+hh-1,line_buf[ww-1]);
-                    }else{
-                        setpixel(self, x0+ww-1, y0+hh-1,~line_buf[ww-1]);
-                    }
-                    
-                }
+    }else if (hh<=h){
+        // 8-bit files hold grey levels and 24-bit ones are taken by their
+        // luminance; both go through the dither stage one row at a time.
+        // Mono targets set dark pixels, as for 1-bit files.
+        int bpp=d->head.biBitcount>>3;
+        bool flip=(d->inv!=0)!=(grey_bits(self->format)==1);
+        int32_t ww;
+        dither_row(&d->dither);
+        for(ww=0;ww<w;ww++){
+            const uint8_t *p=&row[ww*bpp];
+            int g=bpp==1?p[0]:(p[2]*77+p[1]*150+p[0]*29)>>8;
+            if (flip){
+                g=255-g;
             }
+            setpixel(self, x0+ww, y0+hh-1,dither_grey(&d->dither,ww,y0+hh-1,g));
         }
     }
-    mp_stream_close(bmp_file);
-    return mp_const_none;
+    if (d->hh==0) {
+        bmp_end(d);
+    }
+    return true;
 }
 
-STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_show_bmp_obj, 2, 7, framebuf_show_bmp);
+STATIC mp_obj_t framebuf_show_bmp(size_t n_args, const mp_obj_t *args) {
+    // extract arguments; the image is a file name, a stream or a buffer
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args[0]));
+    mp_int_t inv = 0;
+    if (n_args > 2) {
+        inv = mp_obj_get_int(args[2]);
+    }
+    mp_int_t x0 = 0;
+    mp_int_t y0 = 0;
+    if (n_args > 4) {
+        x0 = mp_obj_get_int(args[3]);
+        y0 = mp_obj_get_int(args[4]);
+    } 
+    mp_int_t w = self->width-x0;
+    mp_int_t h = self->height-y0;
+    if (n_args > 6) {
+        w = MIN(mp_obj_get_int(args[5]),w);
+        h = MIN(mp_obj_get_int(args[6]),h);
+    }
+    mp_int_t dither_mode = FRAMEBUF_DITHER_NONE;
+    if (n_args > 7) {
+        dither_mode = dither_arg(args[7]);
+    }
+    bmp_decoder_t d;
+    if (!bmp_begin(&d, self, args[1], inv, x0, y0, w, h, dither_mode)) {
+        return mp_const_none;
+    }
+    // The row buffer is as wide as the file, too big for the stack.
+    d.line_buf = m_new(uint8_t, d.stride);
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        while (d.hh && bmp_step_row(&d)) {
+        }
+        nlr_pop();
+    } else {
+        if (d.hh) {
+            bmp_end(&d);
+        }
+        m_del(uint8_t, d.line_buf, d.stride);
+        nlr_jump(nlr.ret_val);
+    }
+    m_del(uint8_t, d.line_buf, d.stride);
+    return mp_const_none;
+}
 
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_show_bmp_obj, 2, 8, framebuf_show_bmp);
 
-STATIC mp_obj_t framebuf_save_bmp(size_t n_args, const mp_obj_t *args) {
-    // extract arguments
-    BITMAPFILEHEADER bmp_h;
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
-    const char *filename = mp_obj_str_get_str(args[1]);
+// show_bmp split into steps, so a large image can be drawn between other
+// work, e.g. one slice per asyncio task switch.
+typedef struct _mp_obj_bmp_loader_t {
+    mp_obj_base_t base;
+    mp_obj_t fb_obj;
+    mp_obj_t file;          // keeps a buffer alive while it is parsed in place
+    bmp_decoder_t d;
+} mp_obj_bmp_loader_t;
+
+STATIC const mp_obj_type_t mp_type_bmp_loader;
+
+STATIC mp_obj_t framebuf_bmp_loader(size_t n_args, const mp_obj_t *args) {
+    // bmp_loader(fb, file[, x, y[, w, h[, inv[, dither]]]]): returns a
+    // BmpLoader drawing the image as show_bmp does, a few rows per step().
+    mp_obj_t fb_in = mp_obj_cast_to_native_base(args[0], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (fb_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *fb = framebuf_writable(MP_OBJ_TO_PTR(fb_in));
     mp_int_t x0 = 0;
     mp_int_t y0 = 0;
-    if (n_args >= 4) {
+    if (n_args > 3) {
         x0 = mp_obj_get_int(args[2]);
         y0 = mp_obj_get_int(args[3]);
-    } 
-    mp_int_t w = self->width-x0;
-    mp_int_t h = self->height-y0;
-    if (n_args >= 6) {
-        w = MIN(mp_obj_get_int(args[4]),self->width-x0);
-        h = MIN(mp_obj_get_int(args[5]),self->height-y0);
     }
+    mp_int_t w = fb->width - x0;
+    mp_int_t h = fb->height - y0;
+    if (n_args > 5) {
+        w = MIN(mp_obj_get_int(args[4]), w);
+        h = MIN(mp_obj_get_int(args[5]), h);
+    }
+    mp_int_t inv = n_args > 6 ? mp_obj_get_int(args[6]) : 0;
+    mp_int_t dither_mode = n_args > 7 ? dither_arg(args[7]) : FRAMEBUF_DITHER_NONE;
+    mp_obj_bmp_loader_t *o = m_new_obj(mp_obj_bmp_loader_t);
+    o->base.type = &mp_type_bmp_loader;
+    o->fb_obj = fb_in;
+    o->file = args[1];
+    if (bmp_begin(&o->d, fb, args[1], inv, x0, y0, w, h, dither_mode)) {
+        o->d.line_buf = m_new(uint8_t, o->d.stride);
+    }
+    return MP_OBJ_FROM_PTR(o);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_bmp_loader_obj, 2, 8, framebuf_bmp_loader);
+
+STATIC mp_obj_t bmp_loader_step(size_t n_args, const mp_obj_t *args) {
+    // step([n_rows]): decode up to n_rows file rows (default 16) and return
+    // the number of rows left, 0 once the image is done.
+    mp_obj_bmp_loader_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_int_t n = n_args > 1 ? mp_obj_get_int(args[1]) : 16;
+    while (n-- > 0 && self->d.hh && bmp_step_row(&self->d)) {
+    }
+    return MP_OBJ_NEW_SMALL_INT(self->d.hh);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(bmp_loader_step_obj, 1, 2, bmp_loader_step);
 
-    //mp_printf(&mp_plat_print,"%d,%d,%d,%d. \r\n",x0,y0,w,h);
-    memset(&bmp_h,0,sizeof(BITMAPFILEHEADER));   
-    bmp_h.bfType=0x4d42;
-    if (self->format==FRAMEBUF_RGB565 || self->format==FRAMEBUF_RGB565SW){
-        bmp_h.bfOffBits=0x36;//dian zhen cun chu pian yi
-        bmp_h.biBitcount=0x18;
-        bmp_h.bfSize=bmp_h.bfOffBits + w*h*3;   //wen jian zong chi cun
-        bmp_h.biPSize=w*h*3;
-    }else if(((self->format&0xE0)==(FRAMEBUF_MON_VLSB&0xE0))||((self->format&0xE0)==(FRAMEBUF_ST7302&0xE0))){
-        bmp_h.bfOffBits=0x3e;//dian zhen cun chu pian yi
-        bmp_h.biBitcount=0x01;
-        bmp_h.bfSize=bmp_h.bfOffBits +(w+7)*h;   //wen jian zong chi cun
-        bmp_h.biPSize=(w+7)/8*h;
-    }else if (((self->format&0xE0)==(FRAMEBUF_GS2_HMSB&0xE0)) || ((self->format&0xE0)==(FRAMEBUF_GS4_HMSB&0xE0)) || ((self->format&0xE0)==(FRAMEBUF_GS8_H&0xE0))){
-        bmp_h.bfOffBits=0x436;//dian zhen cun chu pian yi
-        bmp_h.biBitcount=0x08;
-        bmp_h.bfSize=bmp_h.bfOffBits + w*h;   //wen jian zong chi cun
-        bmp_h.biPSize=w*h;
-    }else {
-        mp_printf(&mp_plat_print,"Unsupported format. \r\n");
-        return mp_const_none;
+STATIC mp_obj_t bmp_loader_close(mp_obj_t self_in) {
+    // close(): stop early, closing a file opened by name.
+    mp_obj_bmp_loader_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->d.hh) {
+        bmp_end(&self->d);
     }
-    bmp_h.biComp=0x00;
-    bmp_h.biHSize=0x28;
-    bmp_h.biWidth=w;
-    bmp_h.biHeight=h;
-    bmp_h.biPlanes=1;
-    bmp_h.biXPelPerMeter=0;
-    bmp_h.biYPelPerMeter=0;
-    bmp_h.biClrUsed=0x100;
-    bmp_h.biClrImportant=0x100;
-    mp_obj_t f_args[2] = {
-        mp_obj_new_str(filename, strlen(filename)),
-        MP_OBJ_NEW_QSTR(MP_QSTR_wb),
-    }; 
-    //mp_printf(&mp_plat_print,"open file. \r\n");
-    mp_obj_t bmp_file = mp_vfs_open(MP_ARRAY_SIZE(f_args), &f_args[0], (mp_map_t *)&mp_const_empty_map);
-    int errcode;
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(bmp_loader_close_obj, bmp_loader_close);
+
+STATIC const mp_rom_map_elem_t bmp_loader_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_step),        MP_ROM_PTR(&bmp_loader_step_obj) },
+    { MP_ROM_QSTR(MP_QSTR_close),       MP_ROM_PTR(&bmp_loader_close_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(bmp_loader_locals_dict, bmp_loader_locals_dict_table);
+
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_type_bmp_loader,
+    MP_QSTR_BmpLoader,
+    MP_TYPE_FLAG_NONE,
+    locals_dict, &bmp_loader_locals_dict
+    );
+
+
+// Writes the header, colour table and rows of save_bmp().
+STATIC void bmp_write_image(bmp_io_t *io, mp_obj_framebuf_t *self, const BITMAPFILEHEADER *head,
+    uint8_t *line_buf, uint32_t row_bytes, mp_int_t x0, mp_int_t y0, mp_int_t w, mp_int_t h) {
+    BITMAPFILEHEADER bmp_h=*head;
     //mp_printf(&mp_plat_print,"write head. \r\n");
-    int len=mp_stream_rw(bmp_file ,&bmp_h, sizeof(BITMAPFILEHEADER), &errcode, MP_STREAM_OP_WRITE);
-    if (errcode != 0 && len!=sizeof(BITMAPFILEHEADER)) {
-        mp_raise_OSError(errcode);
-        mp_printf(&mp_plat_print,"Write %s error!\r\n",filename);
-    }
+    bmp_io_write(io, &bmp_h, sizeof(BITMAPFILEHEADER));
     uint8_t buf[4];
-    if (bmp_h.biBitcount==0x08){
+    if ((self->format&0xE0)==(FRAMEBUF_PAL2&0xE0)){
+        uint32_t clr;
+        for (clr=0;clr<bmp_h.biClrUsed;clr++){
+            uint32_t col=self->palette[clr];
+            buf[0]=col;
+            buf[1]=col>>8;
+            buf[2]=col>>16;
+            buf[3]=0;
+            bmp_io_write(io, &buf, 4);
+        }
+    }else if (bmp_h.biBitcount==0x08){
         uint32_t clr;
         for (clr=0;clr<0x100;clr++){
             buf[0]=clr;
             buf[1]=clr;
             buf[2]=clr;
             buf[3]=0;
-            len=mp_stream_rw(bmp_file ,&buf, 4, &errcode, MP_STREAM_OP_WRITE);
-            if (errcode != 0 && len!=sizeof(BITMAPFILEHEADER)) {
-                mp_raise_OSError(errcode);
-                mp_printf(&mp_plat_print,"Write %s error!\r\n",filename);
-            }
+            bmp_io_write(io, &buf, 4);
         }
     }
     if (bmp_h.biBitcount==0x01){
@@ -1904,117 +5620,279 @@ STATIC mp_obj_t framebuf_save_bmp(size_t n_args, const mp_obj_t *args) {
             buf[1]=0xff*clr;
             buf[2]=0xff*clr;
             buf[3]=0;
-            len=mp_stream_rw(bmp_file ,&buf, 4, &errcode, MP_STREAM_OP_WRITE);
-            if (errcode != 0 && len!=sizeof(BITMAPFILEHEADER)) {
-                mp_raise_OSError(errcode);
-                mp_printf(&mp_plat_print,"Write %s error!\r\n",filename);
-            }
+            bmp_io_write(io, &buf, 4);
         }
     }
     //mp_printf(&mp_plat_print,"write pixel. \r\n");
     if ((self->format&0xE0)==(FRAMEBUF_RGB565&0xE0)){
-        uint32_t stride=(w+0x03)&(~0x03);
-        uint8_t line_buf[stride][3];
         uint32_t hh,ww;
         uint16_t dot_col;
         for(hh=h;hh;hh--){
-            memset(&line_buf,0,stride*3);
+            memset(line_buf,0,row_bytes);
             for(ww=w;ww;ww--){
+                uint8_t *p=&line_buf[(ww-1)*3];
                 dot_col=getpixel(self, x0+ww-1, y0+hh-1);
                 switch(self->format&0x0F) {
                     case 0:
                     case 1:
-                    line_buf[ww-1][2]=(dot_col&0xf800)>>8;
-                    line_buf[ww-1][1]=(dot_col&0x07e0)>>3;
-                    line_buf[ww-1][0]=(dot_col&0x001e)<<3;
+                    p[2]=(dot_col&0xf800)>>8;
+                    p[1]=(dot_col&0x07e0)>>3;
+                    p[0]=(dot_col&0x001e)<<3;
                     break;
                     case 2:
                     case 3:
-                    line_buf[ww-1][2]=(dot_col&0xff0000)>>16;
-                    line_buf[ww-1][1]=(dot_col&0xff00)>>8;
-                    line_buf[ww-1][0]=(dot_col&0x00ff);
+                    p[2]=(dot_col&0xff0000)>>16;
+                    p[1]=(dot_col&0xff00)>>8;
+                    p[0]=(dot_col&0x00ff);
                     break;
                 }
             }
-            len=mp_stream_rw(bmp_file ,&line_buf, stride*3, &errcode, MP_STREAM_OP_WRITE);
+            bmp_io_write(io, line_buf, row_bytes);
         }
-    }else if(((self->format&0xE0)==(FRAMEBUF_MON_VLSB&0xE0))||((self->format&0xE0)==(FRAMEBUF_ST7302&0xE0))){
-        uint32_t stride=(w+0x1F)&(~0x1F);
-        uint8_t line_buf[stride];
+    }else if ((self->format&0xE0)==(FRAMEBUF_RGB332&0xE0)){
         uint32_t hh,ww;
-        for(hh=h;hh;--hh){
-            memset(&line_buf,0,stride);
-            for(ww=w;ww;--ww){
-                if (getpixel(self, x0+ww-1, y0+hh-1)==0)
-                    line_buf[(ww-1)/8]|=(0x80)>>((ww-1)%8);
+        for(hh=h;hh;hh--){
+            memset(line_buf,0,row_bytes);
+            for(ww=w;ww;ww--){
+                uint8_t *p=&line_buf[(ww-1)*3];
+                uint32_t argb=rgb_to_argb(self->format,getpixel(self, x0+ww-1, y0+hh-1));
+                p[2]=argb>>16;
+                p[1]=argb>>8;
+                p[0]=argb;
             }
-            len=mp_stream_rw(bmp_file ,&line_buf, stride, &errcode, MP_STREAM_OP_WRITE);
+            bmp_io_write(io, line_buf, row_bytes);
         }
-    }else if ((self->format&0xE0)==(FRAMEBUF_GS2_HMSB&0xE0)){
-        uint32_t stride=(w+0x03)&(~0x03);
-        uint8_t line_buf[stride];
+    }else if(((self->format&0xE0)==(FRAMEBUF_MON_VLSB&0xE0))||((self->format&0xE0)==(FRAMEBUF_ST7302&0xE0))){
         uint32_t hh,ww;
         for(hh=h;hh;--hh){
-            memset(&line_buf,0,stride);
+            memset(line_buf,0,row_bytes);
             for(ww=w;ww;--ww){
-                line_buf[(ww-1)]=getpixel(self, x0+ww-1, y0+hh-1)<<6;
+                if (getpixel(self, x0+ww-1, y0+hh-1)==0)
+                    line_buf[(ww-1)/8]|=(0x80)>>((ww-1)%8);
             }
-            len=mp_stream_rw(bmp_file ,&line_buf, stride, &errcode, MP_STREAM_OP_WRITE);
+            bmp_io_write(io, line_buf, row_bytes);
         }
-    }else if ((self->format&0xE0)==(FRAMEBUF_GS4_HMSB&0xE0)){
-        uint32_t stride=(w+0x03)&(~0x03);
-        uint8_t line_buf[stride];
+    }else if ((self->format&0xE0)==(FRAMEBUF_PAL2&0xE0)){
+        int bits=bmp_h.biBitcount;
         uint32_t hh,ww;
         for(hh=h;hh;--hh){
-            memset(&line_buf,0,stride);
-            for(ww=w;ww;--ww){
-                line_buf[(ww-1)]=getpixel(self, x0+ww-1, y0+hh-1)<<4;
+            memset(line_buf,0,row_bytes);
+            for(ww=0;ww<(uint32_t)w;ww++){
+                line_buf[ww*bits>>3]|=getpixel(self, x0+ww, y0+hh-1)<<(8-bits-(ww*bits&7));
             }
-            len=mp_stream_rw(bmp_file ,&line_buf, stride, &errcode, MP_STREAM_OP_WRITE);
+            bmp_io_write(io, line_buf, row_bytes);
         }
-    }else if ((self->format&0xE0)==(FRAMEBUF_GS8_H&0xE0)){
-        uint32_t stride=(w+0x03)&(~0x03);
-        uint8_t line_buf[stride];
+    }else{
+        // Grey levels scaled up to 8 bits.
+        int shift=8-grey_bits(self->format);
         uint32_t hh,ww;
         for(hh=h;hh;--hh){
-            memset(&line_buf,0,stride);
+            memset(line_buf,0,row_bytes);
             for(ww=w;ww;--ww){
-                line_buf[(ww-1)]=getpixel(self, x0+ww-1, y0+hh-1);
+                line_buf[(ww-1)]=getpixel(self, x0+ww-1, y0+hh-1)<<shift;
             }
-            len=mp_stream_rw(bmp_file ,&line_buf, stride, &errcode, MP_STREAM_OP_WRITE);
+            bmp_io_write(io, line_buf, row_bytes);
         }
-    }    //mp_printf(&mp_plat_print,"close file. \r\n");
-    mp_stream_close(bmp_file);
-    return mp_const_none;
+    }
+}
+
+STATIC mp_obj_t framebuf_save_bmp(size_t n_args, const mp_obj_t *args) {
+    // extract arguments; the image goes to a file name, a stream or a
+    // buffer, and the number of bytes written is returned
+    BITMAPFILEHEADER bmp_h;
+    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_int_t x0 = 0;
+    mp_int_t y0 = 0;
+    if (n_args >= 4) {
+        x0 = mp_obj_get_int(args[2]);
+        y0 = mp_obj_get_int(args[3]);
+    } 
+    mp_int_t w = self->width-x0;
+    mp_int_t h = self->height-y0;
+    if (n_args >= 6) {
+        w = MIN(mp_obj_get_int(args[4]),self->width-x0);
+        h = MIN(mp_obj_get_int(args[5]),self->height-y0);
+    }
+
+    //mp_printf(&mp_plat_print,"%d,%d,%d,%d. \r\n",x0,y0,w,h);
+    memset(&bmp_h,0,sizeof(BITMAPFILEHEADER));   
+    bmp_h.bfType=0x4d42;
+    uint32_t row_bytes;
+    if (self->format==FRAMEBUF_RGB565 || self->format==FRAMEBUF_RGB565SW || (self->format&0xE0)==(FRAMEBUF_RGB332&0xE0)){
+        bmp_h.bfOffBits=0x36;//dian zhen cun chu pian yi
+        bmp_h.biBitcount=0x18;
+        row_bytes=(w*3+0x03)&(~0x03);
+    }else if(((self->format&0xE0)==(FRAMEBUF_MON_VLSB&0xE0))||((self->format&0xE0)==(FRAMEBUF_ST7302&0xE0))){
+        bmp_h.bfOffBits=0x3e;//dian zhen cun chu pian yi
+        bmp_h.biBitcount=0x01;
+        row_bytes=((w+0x1F)&(~0x1F))/8;
+    }else if (((self->format&0xE0)==(FRAMEBUF_GS2_HMSB&0xE0)) || ((self->format&0xE0)==(FRAMEBUF_GS4_HMSB&0xE0)) || ((self->format&0xE0)==(FRAMEBUF_GS8_H&0xE0))){
+        bmp_h.bfOffBits=0x436;//dian zhen cun chu pian yi
+        bmp_h.biBitcount=0x08;
+        row_bytes=(w+0x03)&(~0x03);
+    }else if ((self->format&0xE0)==(FRAMEBUF_PAL2&0xE0)){
+        // BMP has no 2-bit depth, PAL2 is saved as 4 bits with a 4 entry
+        // colour table.
+        bmp_h.biBitcount=pal_bits(self->format)==8?0x08:0x04;
+        bmp_h.bfOffBits=0x36+(4<<pal_bits(self->format));
+        row_bytes=((w*bmp_h.biBitcount+0x1F)&(~0x1F))/8;
+    }else {
+        mp_printf(&mp_plat_print,"Unsupported format. \r\n");
+        return mp_const_none;
+    }
+    bmp_h.bfSize=bmp_h.bfOffBits + row_bytes*h;   //wen jian zong chi cun
+    bmp_h.biPSize=row_bytes*h;
+    bmp_h.biComp=0x00;
+    bmp_h.biHSize=0x28;
+    bmp_h.biWidth=w;
+    bmp_h.biHeight=h;
+    bmp_h.biPlanes=1;
+    bmp_h.biXPelPerMeter=0;
+    bmp_h.biYPelPerMeter=0;
+    bmp_h.biClrUsed=0x100;
+    bmp_h.biClrImportant=0x100;
+    if ((self->format&0xE0)==(FRAMEBUF_PAL2&0xE0)){
+        bmp_h.biClrUsed=1<<pal_bits(self->format);
+        bmp_h.biClrImportant=bmp_h.biClrUsed;
+    }
+    // The row buffer is as wide as the image, too big for the stack.
+    uint8_t *line_buf=m_new(uint8_t,row_bytes);
+    //mp_printf(&mp_plat_print,"open file. \r\n");
+    bmp_io_t io;
+    bmp_io_open(&io, args[1], true);
+    // A file opened here is closed again if writing raises.
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        bmp_write_image(&io, self, &bmp_h, line_buf, row_bytes, x0, y0, w, h);
+        nlr_pop();
+    } else {
+        bmp_io_close(&io);
+        m_del(uint8_t, line_buf, row_bytes);
+        nlr_jump(nlr.ret_val);
+    }
+    //mp_printf(&mp_plat_print,"close file. \r\n");
+    m_del(uint8_t, line_buf, row_bytes);
+    bmp_io_close(&io);
+    return mp_obj_new_int(io.pos);
 }
 
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_save_bmp_obj, 2, 6, framebuf_save_bmp);
 
 
+// Palette expansion of grey buffers. Each pixel value picks an entry of
+// esz bytes from the LUT, copied as it is, so the LUT holds colours already
+// in the panel's byte order.
+
+// Pixels below which building the GS4 pair table does not pay off.
+#define LUT_PAIR_MIN (1024)
+
+// Expands rows y0..y1 of a GS2/GS4/GS8 buffer into out, row after row.
+STATIC void lut_expand_rows(const mp_obj_framebuf_t *fb, const uint8_t *lut, int esz, int y0, int y1, uint8_t *out) {
+    int w = fb->width;
+    if (fb->format == FRAMEBUF_GS4_HMSB || fb->format == FRAMEBUF_GS4_HLSB) {
+        // Two pixels per source byte: look both up at once from a table of
+        // 16-bit entry pairs, or take the nibbles one at a time.
+        bool msb = fb->format == FRAMEBUF_GS4_HMSB;
+        bool pairs = esz == 2 && (size_t)(y1 - y0) * w >= LUT_PAIR_MIN;
+        // Static, to keep the 1KB table off the stack without allocating;
+        // it is rebuilt on every call.
+        static uint16_t pair[256][2];
+        if (pairs) {
+            for (int b = 0; b < 256; b++) {
+                int first = msb ? b >> 4 : b & 0x0f, second = msb ? b & 0x0f : b >> 4;
+                memcpy(&pair[b][0], &lut[first * 2], 2);
+                memcpy(&pair[b][1], &lut[second * 2], 2);
+            }
+        }
+        for (int y = y0; y < y1; y++) {
+            const uint8_t *src = &((const uint8_t *)fb->buf)[(band_row(fb, y) * fb->stride) >> 1];
+            int x = 0;
+            if (pairs) {
+                for (; x + 2 <= w; x += 2, out += 4) {
+                    memcpy(out, pair[src[x >> 1]], 4);
+                }
+            }
+            for (; x < w; x++, out += esz) {
+                int shift = (x & 1) != msb ? 4 : 0;
+                memcpy(out, &lut[((src[x >> 1] >> shift) & 0x0f) * esz], esz);
+            }
+        }
+        return;
+    }
+    uint32_t vals[CONVERT_CHUNK];
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < w; x += CONVERT_CHUNK) {
+            int n = MIN(CONVERT_CHUNK, w - x);
+            convert_read_row(fb, x, y, n, vals);
+            for (int i = 0; i < n; i++, out += esz) {
+                memcpy(out, &lut[vals[i] * esz], esz);
+            }
+        }
+    }
+}
+
+STATIC mp_obj_t framebuf_lut_expand(size_t n_args, const mp_obj_t *args) {
+    // lut_expand(lut, dst_buf[, y0[, y1]]): write rows y0..y1-1 of a grey
+    // buffer into dst_buf through lut, whose 2, 3 or 4 byte entries follow
+    // from its length. Nothing is allocated. Banded buffers expand the rows
+    // of their band.
+    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_buffer_info_t lut, dst;
+    mp_get_buffer_raise(args[1], &lut, MP_BUFFER_READ);
+    mp_get_buffer_raise(args[2], &dst, MP_BUFFER_WRITE);
+    int bits;
+    switch (self->format & 0xE0) {
+        case FRAMEBUF_GS2_HMSB & 0xE0:
+        case FRAMEBUF_GS4_HMSB & 0xE0:
+        case FRAMEBUF_GS8_H & 0xE0:
+            bits = grey_bits(self->format);
+            break;
+        default:
+            mp_raise_ValueError(MP_ERROR_TEXT("only GS2, GS4 and GS8 are supported"));
+    }
+    size_t esz = lut.len >> bits;
+    if (esz < 2 || esz > 4 || lut.len != esz << bits) {
+        mp_raise_ValueError(MP_ERROR_TEXT("LUT needs 2, 3 or 4 byte entries"));
+    }
+    int y0 = 0, y1 = self->height;
+    if (n_args > 3) {
+        y0 = MAX(0, mp_obj_get_int(args[3]));
+    }
+    if (n_args > 4) {
+        y1 = MIN(self->height, mp_obj_get_int(args[4]));
+    }
+    band_clip(self, &y0, &y1);
+    if (y0 >= y1) {
+        return mp_const_none;
+    }
+    if (dst.len < (size_t)(y1 - y0) * self->width * esz) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buffer too small"));
+    }
+    lut_expand_rows(self, lut.buf, esz, y0, y1, dst.buf);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_lut_expand_obj, 3, 5, framebuf_lut_expand);
+
 STATIC mp_obj_t framebuf_line_LUT(mp_obj_t self_in, mp_obj_t line, mp_obj_t lut_in) {
-    // 行转换，输入参数：行，查找表，返回行数据
+    // 行转换，输入参数：行，查找表，返回行数据；整帧转换用lut_expand
     mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(self_in);
     mp_buffer_info_t lut;
     mp_get_buffer_raise(lut_in, &lut, MP_BUFFER_READ);
-    uint16_t line_num = mp_obj_get_int(line);
-    uint16_t buff[self->width];
-    mp_obj_t  ret_buf = mp_obj_new_bytearray(32,(uint8_t*)&buff);
-    uint16_t col_dot;
+    mp_int_t line_num = mp_obj_get_int(line);
     if (lut.len!=32) {
         mp_printf(&mp_plat_print,"LUT table Error. \r\n");
         return mp_const_none;
     }
-    if ((self->format&0xF0)==(FRAMEBUF_GS4_HMSB&0xF0)){
-        for(int ww=0;ww<self->width;ww++)
-        {
-            col_dot=getpixel(self, ww, line_num);
-            buff[ww] =((uint16_t *) lut.buf)[col_dot];
-        }
-    } else{
+    if ((self->format&0xF0)!=(FRAMEBUF_GS4_HMSB&0xF0)){
         mp_printf(&mp_plat_print,"Only 4 bit mode is supported. \r\n");
         return mp_const_none;
     }
-    return ret_buf;
+    size_t len = self->width * 2;
+    uint8_t *buff = m_new0(uint8_t, len);
+    if (0 <= line_num && line_num < self->height) {
+        lut_expand_rows(self, lut.buf, 2, line_num, line_num + 1, buff);
+    }
+    return mp_obj_new_bytearray_by_ref(len, buff);
 }
 
 STATIC MP_DEFINE_CONST_FUN_OBJ_3(framebuf_line_LUT_obj, framebuf_line_LUT);
@@ -2105,7 +5983,7 @@ STATIC mp_obj_t framebuf_curve(size_t n_args, const mp_obj_t *args) {
     //输入数据，x,y,x_scale,y_scale,mode,col
     //
     // 使用列表或者bytearray输入绘制曲线
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args[0]));
     mp_obj_t Data_obj = args[1];
     //if((mp_obj_is_type(Chart_obj, &mp_type_tuple) || mp_obj_is_type(Chart_obj, &mp_type_list)))
     //mp_obj_get_array(Chart_obj, &duration_length, &duration_ptr);
@@ -2185,6 +6063,117 @@ STATIC mp_obj_t framebuf_curve(size_t n_args, const mp_obj_t *args) {
     return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_curve_obj, 2, 8, framebuf_curve);
+
+#if MICROPY_PY_ARRAY && !MICROPY_ENABLE_DYNRUNTIME
+// Display lists. A list is an integer array of commands, each an opcode
+// followed by a fixed number of arguments, so any field can be patched in
+// place between replays. FrameBuffers and strings are given by their index
+// in a separate sequence.
+
+// Arguments of each opcode.
+STATIC const uint8_t dl_n_args[] = {
+    [FRAMEBUF_DL_END] = 0,
+    [FRAMEBUF_DL_FILL] = 1,         // col
+    [FRAMEBUF_DL_PIXEL] = 3,        // x, y, col
+    [FRAMEBUF_DL_HLINE] = 4,        // x, y, w, col
+    [FRAMEBUF_DL_VLINE] = 4,        // x, y, h, col
+    [FRAMEBUF_DL_LINE] = 5,         // x1, y1, x2, y2, col
+    [FRAMEBUF_DL_RECT] = 5,         // x, y, w, h, col
+    [FRAMEBUF_DL_FILL_RECT] = 6,    // x, y, w, h, col, rop
+    [FRAMEBUF_DL_ELLIPSE] = 6,      // x, y, xr, yr, col, fill
+    [FRAMEBUF_DL_BLIT] = 4,         // fbuf, x, y, key
+    [FRAMEBUF_DL_TEXT] = 4,         // string, x, y, col
+};
+
+// Reads item i of an integer array, straight from memory for the common
+// typecodes.
+STATIC mp_int_t dl_int(mp_buffer_info_t *bufinfo, size_t i) {
+    switch (bufinfo->typecode) {
+        case 'b':
+            return ((const int8_t *)bufinfo->buf)[i];
+        case 'h':
+            return ((const int16_t *)bufinfo->buf)[i];
+        case 'H':
+            return ((const uint16_t *)bufinfo->buf)[i];
+        case 'i':
+            return ((const int *)bufinfo->buf)[i];
+        case 'I':
+            return ((const unsigned int *)bufinfo->buf)[i];
+        default:
+            return poly_int(bufinfo, i);
+    }
+}
+
+STATIC mp_obj_t framebuf_execute(size_t n_args, const mp_obj_t *args) {
+    // execute(display_list[, objects]): run the commands in display_list
+    // up to its end or a DL_END; objects holds the FrameBuffers and strings
+    // of DL_BLIT and DL_TEXT.
+    mp_obj_framebuf_t *self = framebuf_writable(MP_OBJ_TO_PTR(args[0]));
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[1], &bufinfo, MP_BUFFER_READ);
+    size_t n = bufinfo.len / mp_binary_get_size('@', bufinfo.typecode, NULL);
+    size_t n_objs = 0;
+    mp_obj_t *objs = NULL;
+    if (n_args > 2) {
+        mp_obj_get_array(args[2], &n_objs, &objs);
+    }
+    mp_int_t a[6];
+    for (size_t i = 0; i < n;) {
+        mp_int_t op = dl_int(&bufinfo, i++);
+        if (op == FRAMEBUF_DL_END) {
+            break;
+        }
+        if (op < 0 || op >= (mp_int_t)MP_ARRAY_SIZE(dl_n_args) || i + dl_n_args[op] > n) {
+            mp_raise_ValueError(MP_ERROR_TEXT("invalid display list"));
+        }
+        for (int k = 0; k < dl_n_args[op]; k++) {
+            a[k] = dl_int(&bufinfo, i++);
+        }
+        if ((op == FRAMEBUF_DL_BLIT || op == FRAMEBUF_DL_TEXT) && (a[0] < 0 || (size_t)a[0] >= n_objs)) {
+            mp_raise_ValueError(MP_ERROR_TEXT("invalid display list"));
+        }
+        switch (op) {
+            case FRAMEBUF_DL_FILL:
+                fill_rect(self, 0, 0, self->width, self->height, a[0]);
+                break;
+            case FRAMEBUF_DL_PIXEL:
+                setpixel(self, a[0], a[1], a[2]);
+                break;
+            case FRAMEBUF_DL_HLINE:
+                fill_rect(self, a[0], a[1], a[2], 1, a[3]);
+                break;
+            case FRAMEBUF_DL_VLINE:
+                fill_rect(self, a[0], a[1], 1, a[2], a[3]);
+                break;
+            case FRAMEBUF_DL_LINE:
+                line(self, a[0], a[1], a[2], a[3], a[4]);
+                break;
+            case FRAMEBUF_DL_FILL_RECT:
+                fill_rect_rop(self, a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+            case FRAMEBUF_DL_RECT:
+                draw_rect(self, a[0], a[1], a[2], a[3], a[4], false, 1, FRAMEBUF_ROP_COPY);
+                break;
+            case FRAMEBUF_DL_ELLIPSE:
+                draw_ellipse(self, a[0], a[1], a[2], a[3], a[4], ELLIPSE_MASK_ALL | (a[5] ? ELLIPSE_MASK_FILL : 0), 1);
+                break;
+            case FRAMEBUF_DL_BLIT: {
+                mp_obj_t source_in = mp_obj_cast_to_native_base(objs[a[0]], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+                if (source_in == MP_OBJ_NULL) {
+                    mp_raise_TypeError(NULL);
+                }
+                draw_blit(self, MP_OBJ_TO_PTR(source_in), a[1], a[2], a[3], NULL, FRAMEBUF_ROP_COPY);
+                break;
+            }
+            case FRAMEBUF_DL_TEXT:
+                draw_text(self, mp_obj_str_get_str(objs[a[0]]), a[1], a[2], a[3]);
+                break;
+        }
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_execute_obj, 2, 3, framebuf_execute);
+#endif // MICROPY_PY_ARRAY && !MICROPY_ENABLE_DYNRUNTIME
 #if !MICROPY_ENABLE_DYNRUNTIME
 STATIC const mp_rom_map_elem_t framebuf_locals_dict_table[] = {
     { MP_ROM_QSTR(MP_QSTR_show_bmp),    MP_ROM_PTR(&framebuf_show_bmp_obj) },
@@ -2194,6 +6183,8 @@ STATIC const mp_rom_map_elem_t framebuf_locals_dict_table[] = {
     { MP_ROM_QSTR(MP_QSTR_font_set),    MP_ROM_PTR(&framebuf_font_set_obj) },
     { MP_ROM_QSTR(MP_QSTR_ToGBK),       MP_ROM_PTR(&framebuf_ToGBK_obj) },
     { MP_ROM_QSTR(MP_QSTR_fill),        MP_ROM_PTR(&framebuf_fill_obj) },
+    { MP_ROM_QSTR(MP_QSTR_band),        MP_ROM_PTR(&framebuf_band_obj) },
+    { MP_ROM_QSTR(MP_QSTR_tile),        MP_ROM_PTR(&framebuf_tile_obj) },
     { MP_ROM_QSTR(MP_QSTR_fill_rect),   MP_ROM_PTR(&framebuf_fill_rect_obj) },
     { MP_ROM_QSTR(MP_QSTR_pixel),       MP_ROM_PTR(&framebuf_pixel_obj) },
     { MP_ROM_QSTR(MP_QSTR_hline),       MP_ROM_PTR(&framebuf_hline_obj) },
@@ -2201,14 +6192,35 @@ STATIC const mp_rom_map_elem_t framebuf_locals_dict_table[] = {
     { MP_ROM_QSTR(MP_QSTR_rect),        MP_ROM_PTR(&framebuf_rect_obj) },
     { MP_ROM_QSTR(MP_QSTR_line),        MP_ROM_PTR(&framebuf_line_obj) },
     { MP_ROM_QSTR(MP_QSTR_ellipse),     MP_ROM_PTR(&framebuf_ellipse_obj) },
+    { MP_ROM_QSTR(MP_QSTR_arc),         MP_ROM_PTR(&framebuf_arc_obj) },
+    { MP_ROM_QSTR(MP_QSTR_pie),         MP_ROM_PTR(&framebuf_pie_obj) },
+    { MP_ROM_QSTR(MP_QSTR_round_rect),  MP_ROM_PTR(&framebuf_round_rect_obj) },
     #if MICROPY_PY_ARRAY
     { MP_ROM_QSTR(MP_QSTR_poly),        MP_ROM_PTR(&framebuf_poly_obj) },
+    { MP_ROM_QSTR(MP_QSTR_polys),       MP_ROM_PTR(&framebuf_polys_obj) },
     { MP_ROM_QSTR(MP_QSTR_curve),       MP_ROM_PTR(&framebuf_curve_obj) },
     #endif
     { MP_ROM_QSTR(MP_QSTR_blit),        MP_ROM_PTR(&framebuf_blit_obj) },
+    { MP_ROM_QSTR(MP_QSTR_blit_blend),  MP_ROM_PTR(&framebuf_blit_blend_obj) },
+    { MP_ROM_QSTR(MP_QSTR_blit_mask),   MP_ROM_PTR(&framebuf_blit_mask_obj) },
+    { MP_ROM_QSTR(MP_QSTR_blit_scaled), MP_ROM_PTR(&framebuf_blit_scaled_obj) },
+    { MP_ROM_QSTR(MP_QSTR_blit_rotated), MP_ROM_PTR(&framebuf_blit_rotated_obj) },
+    { MP_ROM_QSTR(MP_QSTR_tilemap),     MP_ROM_PTR(&framebuf_tilemap_obj) },
+    { MP_ROM_QSTR(MP_QSTR_convert),     MP_ROM_PTR(&framebuf_convert_obj) },
+    { MP_ROM_QSTR(MP_QSTR_convert_rows), MP_ROM_PTR(&framebuf_convert_rows_obj) },
+    { MP_ROM_QSTR(MP_QSTR_diff),        MP_ROM_PTR(&framebuf_diff_obj) },
+    { MP_ROM_QSTR(MP_QSTR_swap_buffers), MP_ROM_PTR(&framebuf_swap_buffers_obj) },
+    { MP_ROM_QSTR(MP_QSTR_iter_rows),   MP_ROM_PTR(&framebuf_iter_rows_obj) },
+    { MP_ROM_QSTR(MP_QSTR_palette),     MP_ROM_PTR(&framebuf_palette_obj) },
+    { MP_ROM_QSTR(MP_QSTR_linearize),   MP_ROM_PTR(&framebuf_linearize_obj) },
+    #if MICROPY_PY_ARRAY
+    { MP_ROM_QSTR(MP_QSTR_blit_many),   MP_ROM_PTR(&framebuf_blit_many_obj) },
+    { MP_ROM_QSTR(MP_QSTR_execute),     MP_ROM_PTR(&framebuf_execute_obj) },
+    #endif
     { MP_ROM_QSTR(MP_QSTR_scroll),      MP_ROM_PTR(&framebuf_scroll_obj) },
     { MP_ROM_QSTR(MP_QSTR_text),        MP_ROM_PTR(&framebuf_text_obj) },
     { MP_ROM_QSTR(MP_QSTR_line_LUT),    MP_ROM_PTR(&framebuf_line_LUT_obj) },
+    { MP_ROM_QSTR(MP_QSTR_lut_expand),  MP_ROM_PTR(&framebuf_lut_expand_obj) },
 
 };
 STATIC MP_DEFINE_CONST_DICT(framebuf_locals_dict, framebuf_locals_dict_table);
@@ -2234,14 +6246,19 @@ STATIC mp_obj_t legacy_framebuffer1(size_t n_args, const mp_obj_t *args) {
     mp_get_buffer_raise(args[0], &bufinfo, MP_BUFFER_WRITE);
     o->buf = bufinfo.buf;
 
-    o->width = mp_obj_get_int(args[1]);
-    o->height = mp_obj_get_int(args[2]);
+    mp_int_t width = mp_obj_get_int(args[1]);
+    mp_int_t height = mp_obj_get_int(args[2]);
+    mp_int_t stride = n_args >= 4 ? mp_obj_get_int(args[3]) : width;
+    framebuf_check_size(FRAMEBUF_MON_VLSB, width, height, stride);
+    o->width = width;
+    o->height = height;
+    o->stride = stride;
     o->format = FRAMEBUF_MON_VLSB;
-    if (n_args >= 4) {
-        o->stride = mp_obj_get_int(args[3]);
-    } else {
-        o->stride = o->width;
-    }
+    o->read_only = false;
+    o->palette = NULL;
+    o->tile = 0;
+    o->band_y = 0;
+    o->band_h = 0;
 
     return MP_OBJ_FROM_PTR(o);
 }
@@ -2252,6 +6269,7 @@ STATIC const mp_rom_map_elem_t framebuf_module_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR___name__),    MP_ROM_QSTR(MP_QSTR_framebuf) },
     { MP_ROM_QSTR(MP_QSTR_FrameBuffer), MP_ROM_PTR(&mp_type_framebuf) },
     { MP_ROM_QSTR(MP_QSTR_FrameBuffer1), MP_ROM_PTR(&legacy_framebuffer1_obj) },
+    { MP_ROM_QSTR(MP_QSTR_bmp_loader),  MP_ROM_PTR(&framebuf_bmp_loader_obj) },
     { MP_ROM_QSTR(MP_QSTR_MONO_HLSB),   MP_ROM_INT(FRAMEBUF_MON_HLSB) },
     { MP_ROM_QSTR(MP_QSTR_MONO_HMSB),   MP_ROM_INT(FRAMEBUF_MON_HMSB) },
     { MP_ROM_QSTR(MP_QSTR_MONO_VLSB),   MP_ROM_INT(FRAMEBUF_MON_VLSB) },
@@ -2271,9 +6289,37 @@ STATIC const mp_rom_map_elem_t framebuf_module_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR_RGB888),      MP_ROM_INT(FRAMEBUF_RGB888) },
     { MP_ROM_QSTR(MP_QSTR_RGB8888),     MP_ROM_INT(FRAMEBUF_RGB8888) },
     { MP_ROM_QSTR(MP_QSTR_ST7302),      MP_ROM_INT(FRAMEBUF_ST7302) },
+    { MP_ROM_QSTR(MP_QSTR_RGB332),      MP_ROM_INT(FRAMEBUF_RGB332) },
+    { MP_ROM_QSTR(MP_QSTR_RGB444),      MP_ROM_INT(FRAMEBUF_RGB444) },
+    { MP_ROM_QSTR(MP_QSTR_RGB666),      MP_ROM_INT(FRAMEBUF_RGB666) },
+    { MP_ROM_QSTR(MP_QSTR_PAL2),        MP_ROM_INT(FRAMEBUF_PAL2) },
+    { MP_ROM_QSTR(MP_QSTR_PAL4),        MP_ROM_INT(FRAMEBUF_PAL4) },
+    { MP_ROM_QSTR(MP_QSTR_PAL8),        MP_ROM_INT(FRAMEBUF_PAL8) },
     { MP_ROM_QSTR(MP_QSTR_MX),          MP_ROM_INT(FRAMEBUF_MX) },
     { MP_ROM_QSTR(MP_QSTR_MY),          MP_ROM_INT(FRAMEBUF_MY) },
     { MP_ROM_QSTR(MP_QSTR_MV),          MP_ROM_INT(FRAMEBUF_MV) },
+    { MP_ROM_QSTR(MP_QSTR_EVEN_ODD),    MP_ROM_INT(POLY_EVEN_ODD) },
+    { MP_ROM_QSTR(MP_QSTR_NON_ZERO),    MP_ROM_INT(POLY_NON_ZERO) },
+    { MP_ROM_QSTR(MP_QSTR_ROP_COPY),    MP_ROM_INT(FRAMEBUF_ROP_COPY) },
+    { MP_ROM_QSTR(MP_QSTR_ROP_XOR),     MP_ROM_INT(FRAMEBUF_ROP_XOR) },
+    { MP_ROM_QSTR(MP_QSTR_ROP_OR),      MP_ROM_INT(FRAMEBUF_ROP_OR) },
+    { MP_ROM_QSTR(MP_QSTR_ROP_AND),     MP_ROM_INT(FRAMEBUF_ROP_AND) },
+    { MP_ROM_QSTR(MP_QSTR_ROP_NOT),     MP_ROM_INT(FRAMEBUF_ROP_NOT) },
+    { MP_ROM_QSTR(MP_QSTR_DITHER_NONE), MP_ROM_INT(FRAMEBUF_DITHER_NONE) },
+    { MP_ROM_QSTR(MP_QSTR_DITHER_BAYER4), MP_ROM_INT(FRAMEBUF_DITHER_BAYER4) },
+    { MP_ROM_QSTR(MP_QSTR_DITHER_BAYER8), MP_ROM_INT(FRAMEBUF_DITHER_BAYER8) },
+    { MP_ROM_QSTR(MP_QSTR_DITHER_FS),   MP_ROM_INT(FRAMEBUF_DITHER_FS) },
+    { MP_ROM_QSTR(MP_QSTR_DL_END),       MP_ROM_INT(FRAMEBUF_DL_END) },
+    { MP_ROM_QSTR(MP_QSTR_DL_FILL),      MP_ROM_INT(FRAMEBUF_DL_FILL) },
+    { MP_ROM_QSTR(MP_QSTR_DL_PIXEL),     MP_ROM_INT(FRAMEBUF_DL_PIXEL) },
+    { MP_ROM_QSTR(MP_QSTR_DL_HLINE),     MP_ROM_INT(FRAMEBUF_DL_HLINE) },
+    { MP_ROM_QSTR(MP_QSTR_DL_VLINE),     MP_ROM_INT(FRAMEBUF_DL_VLINE) },
+    { MP_ROM_QSTR(MP_QSTR_DL_LINE),      MP_ROM_INT(FRAMEBUF_DL_LINE) },
+    { MP_ROM_QSTR(MP_QSTR_DL_RECT),      MP_ROM_INT(FRAMEBUF_DL_RECT) },
+    { MP_ROM_QSTR(MP_QSTR_DL_FILL_RECT),  MP_ROM_INT(FRAMEBUF_DL_FILL_RECT) },
+    { MP_ROM_QSTR(MP_QSTR_DL_ELLIPSE),   MP_ROM_INT(FRAMEBUF_DL_ELLIPSE) },
+    { MP_ROM_QSTR(MP_QSTR_DL_BLIT),      MP_ROM_INT(FRAMEBUF_DL_BLIT) },
+    { MP_ROM_QSTR(MP_QSTR_DL_TEXT),      MP_ROM_INT(FRAMEBUF_DL_TEXT) },
     
     { MP_ROM_QSTR(MP_QSTR_Font_S12), MP_ROM_INT(Font_S12) },
     { MP_ROM_QSTR(MP_QSTR_Font_C12), MP_ROM_INT(Font_C12) },